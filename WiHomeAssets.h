@@ -0,0 +1,122 @@
+// WiHome static web assets (gzip compressed)
+// Generated by tools/gzip_assets.py from data/ - do not edit.
+#include <pgmspace.h>
+#include "Arduino.h"
+
+#ifndef WIHOMEASSETS_H
+#define WIHOMEASSETS_H
+
+struct WiHomeAsset
+{
+  const char* uri;
+  const char* content_type;
+  const char* etag;
+  const char* cache_control;
+  const uint8_t* data;
+  size_t length;
+};
+
+// index.html: 470 bytes, 282 bytes gzipped
+const uint8_t asset_index_html_gz[] PROGMEM = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x95,0x51,0x3d,0x6b,0xc3,0x30,
+  0x10,0xdd,0xf3,0x2b,0xd4,0x49,0x53,0x63,0xc8,0x58,0x6c,0x2f,0x69,0x21,0xd0,0xa1,
+  0x85,0x16,0x4a,0xc7,0xb3,0x74,0xc6,0xd7,0xea,0xc3,0x48,0x67,0x07,0xff,0xfb,0x9e,
+  0xec,0x84,0xa6,0x63,0x07,0x71,0xbc,0x8f,0x3b,0x1e,0x4f,0xf5,0xdd,0xe3,0xcb,0xf1,
+  0xfd,0xf3,0xf5,0x49,0x0d,0xec,0x5d,0xbb,0xab,0xaf,0x03,0xc1,0xca,0xf0,0xc8,0xa0,
+  0x02,0x78,0x6c,0xf4,0x4c,0x78,0x1e,0x63,0x62,0xad,0x4c,0x0c,0x8c,0x81,0x1b,0x7d,
+  0x26,0xcb,0x43,0x63,0x71,0x26,0x83,0xf7,0x2b,0xd0,0xb2,0xe3,0x28,0x7c,0xab,0x84,
+  0xae,0xd1,0x99,0x17,0x87,0x79,0x40,0x94,0xa5,0x21,0x61,0xdf,0xe8,0x6a,0xa5,0xf6,
+  0x26,0xe7,0xe2,0xcc,0x26,0xd1,0xc8,0x2a,0x27,0x23,0x8a,0x07,0x0a,0xfb,0xaf,0xac,
+  0x95,0xc5,0x1e,0x53,0x5b,0x57,0x9b,0x2a,0xb6,0xea,0x12,0xa6,0x8b,0x76,0x29,0xd1,
+  0x0e,0xed,0x07,0x9d,0xa2,0x47,0x75,0x7a,0xee,0x21,0x88,0x7c,0x68,0x77,0x47,0x47,
+  0x12,0xe9,0x41,0xd5,0x79,0x84,0xa0,0xc8,0x36,0xda,0xac,0x8c,0x2e,0x87,0x84,0x6a,
+  0xeb,0x2e,0xb5,0xbb,0x37,0x06,0x9e,0xf2,0xad,0x2b,0xaf,0xcc,0x5f,0x57,0x6d,0x69,
+  0x5e,0xc5,0xd2,0x45,0x91,0x04,0x0b,0xdb,0xc7,0xe4,0x15,0x18,0xa6,0x18,0x24,0xae,
+  0xbe,0xf1,0x8d,0x90,0x20,0xff,0x1a,0xe5,0xc6,0xfa,0x28,0x8c,0x13,0x2b,0x5e,0x46,
+  0x69,0x2f,0x4f,0x9d,0x27,0xa9,0x61,0xeb,0xf2,0x8a,0x66,0x70,0x53,0x81,0x30,0xa3,
+  0xfe,0x87,0x5f,0xca,0x8d,0x60,0x4b,0x82,0xaa,0x84,0x2a,0xf3,0xd2,0x4d,0xb5,0x7d,
+  0xdf,0x0f,0xa3,0x15,0xa0,0x80,0xd6,0x01,0x00,0x00,
+};
+
+// main.js: 2392 bytes, 901 bytes gzipped
+const uint8_t asset_main_js_gz[] PROGMEM = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x8d,0x56,0x4b,0x73,0xd3,0x30,
+  0x10,0xbe,0xe7,0x57,0x2c,0x27,0xd9,0x43,0xc6,0x29,0x1c,0x09,0x3d,0x40,0x29,0xaf,
+  0x29,0x85,0xa1,0x85,0x81,0xe9,0xf4,0xa0,0x58,0x9b,0x46,0xe0,0x48,0x46,0x92,0x1b,
+  0x3a,0xd0,0xff,0xce,0x4a,0x6b,0x35,0x4e,0xda,0x86,0x1e,0x5a,0xcb,0xda,0xf7,0x7e,
+  0xdf,0xae,0x33,0x99,0xc0,0x6b,0xdd,0x34,0x1e,0xc2,0x02,0xc1,0x07,0x19,0x74,0x0d,
+  0x4b,0xa9,0x0d,0xb4,0xf2,0x82,0x2e,0x16,0xd8,0x34,0xb0,0xd2,0x61,0x91,0xe4,0x97,
+  0xb2,0xe9,0xd0,0xc3,0xdc,0xd9,0x25,0x4c,0xf8,0xa5,0xfa,0xe1,0xad,0x19,0xcd,0x3b,
+  0x53,0x07,0x6d,0x0d,0x48,0xa5,0x3e,0xb6,0xf1,0x54,0x78,0x6c,0xb0,0x0e,0x63,0xb6,
+  0x19,0x43,0xc0,0xdf,0xf4,0xc2,0x97,0xa8,0xca,0xd1,0x9f,0x11,0x90,0xc8,0x81,0x4d,
+  0xda,0xb0,0x0f,0xca,0xd6,0xdd,0x12,0x4d,0xa8,0x6a,0x87,0x32,0xe0,0x61,0x83,0xf1,
+  0xad,0x10,0xac,0x20,0xca,0x29,0x19,0xf0,0xb9,0x4a,0x2e,0xc9,0x24,0x3d,0x07,0xf7,
+  0x31,0x06,0x5d,0xc7,0xc7,0xe0,0x36,0xc7,0x24,0x49,0x3e,0x46,0x29,0x9f,0x2b,0xd9,
+  0xb6,0x68,0xd4,0xc1,0x42,0x37,0xaa,0x60,0x03,0x8a,0x74,0x3d,0xda,0xa8,0xe8,0x93,
+  0x74,0x72,0x89,0x01,0x5d,0x31,0xb7,0x6e,0x39,0xa6,0xd6,0x38,0xc9,0x15,0xc4,0xf7,
+  0x0d,0x17,0xf7,0x55,0x31,0x73,0xa2,0x4c,0x25,0xfc,0xcf,0xe2,0x94,0x92,0x3f,0xb6,
+  0x0a,0x8b,0x18,0xa4,0x6a,0xa9,0xd3,0x6d,0x78,0x98,0xe5,0xed,0x58,0xb1,0xbf,0xda,
+  0xb4,0x5d,0xea,0x86,0x9e,0x03,0xfb,0x0c,0x57,0x2d,0x35,0x6f,0x1f,0xc4,0xcc,0xda,
+  0x46,0x94,0x24,0x8a,0x95,0x00,0x6b,0xee,0x00,0x82,0x1b,0xc6,0x40,0xc0,0x00,0xe8,
+  0x64,0x37,0x06,0xb1,0x27,0xe8,0xdf,0xb1,0x15,0xdc,0x9f,0x0c,0xd2,0x7e,0x14,0xdc,
+  0x6b,0xf3,0x24,0xda,0x7c,0x47,0x7f,0xdb,0xe8,0x09,0x1b,0x5d,0xd3,0x1f,0x36,0x1e,
+  0x1f,0x9c,0x65,0x92,0xe7,0x80,0xe9,0xa5,0x2f,0x18,0x44,0xe4,0x85,0x18,0x0a,0x32,
+  0x8f,0xd6,0xa1,0x73,0x48,0x96,0x1b,0x42,0x3d,0x8b,0xe3,0xf9,0x4e,0x14,0x92,0xea,
+  0x16,0x67,0xfc,0xc2,0xae,0xbe,0xa6,0xf1,0x28,0x78,0x4a,0x98,0x2d,0x37,0x39,0x5f,
+  0x60,0xe8,0x13,0x7e,0x79,0xf5,0x4e,0x15,0xa2,0x6e,0x34,0x9d,0x45,0x99,0x18,0x7c,
+  0x60,0x4d,0xa0,0xb7,0xcc,0x6f,0x5f,0xb1,0x74,0xba,0xcb,0xc1,0x22,0x2c,0x09,0xca,
+  0x4a,0x1b,0x83,0xee,0xed,0xe9,0x87,0xa3,0xb5,0x71,0x94,0xc0,0xdf,0xbf,0x20,0x44,
+  0x66,0x44,0xac,0x60,0xd8,0xc0,0x6d,0x5f,0xb1,0x5c,0xcf,0x1d,0x9c,0x4c,0xe0,0x95,
+  0x05,0x63,0x03,0xd8,0x4b,0x74,0x2b,0xa7,0x03,0x82,0x4c,0xfd,0x48,0xe3,0x90,0x76,
+  0x42,0xe7,0xe9,0xa0,0x3d,0xd4,0x9d,0x73,0xe4,0xa3,0xb9,0x02,0x54,0x3a,0x68,0x73,
+  0xf1,0xac,0x27,0x5d,0xea,0x58,0x4d,0x45,0xd1,0x56,0xf1,0x6b,0xd2,0x4a,0x6a,0xd5,
+  0x65,0xc6,0xad,0x2c,0x13,0x2c,0x0e,0x43,0xe7,0xcc,0x4d,0x9b,0x87,0xe5,0x70,0xfe,
+  0x74,0x0d,0x45,0x2c,0x22,0x6e,0x8c,0xbd,0x29,0x3d,0x9e,0xe7,0x42,0x53,0xda,0x55,
+  0x83,0xe6,0x22,0x2c,0x48,0xf0,0xf8,0x71,0x99,0x39,0xb7,0x3d,0xbe,0x43,0x83,0x33,
+  0x73,0xce,0xd8,0x45,0xa7,0x71,0xfd,0x75,0xfe,0x98,0x94,0x3d,0xb9,0x3f,0x13,0x5f,
+  0xcc,0x4f,0x63,0x57,0x26,0x72,0x94,0x40,0x31,0x69,0x75,0x30,0xc9,0x61,0xd1,0xcd,
+  0xe2,0xe9,0x95,0xf6,0xf5,0x50,0x72,0x62,0xe7,0xe1,0xc5,0x27,0x71,0x3e,0xdd,0x22,
+  0xc3,0x49,0xf2,0x5c,0xe0,0x65,0xac,0xf5,0x66,0xf7,0x71,0x3c,0x0a,0xf5,0xfe,0xe4,
+  0xe3,0x71,0xcc,0xc7,0x23,0xab,0x54,0x4a,0x06,0x59,0x56,0x2c,0xdf,0x09,0x3c,0xab,
+  0xdc,0x62,0xce,0xa0,0x92,0x33,0x3e,0x9f,0x47,0x12,0x64,0x87,0x54,0x2f,0x41,0xfb,
+  0xa2,0x6d,0x1b,0x5d,0xcb,0x94,0xe4,0x5c,0x63,0xa3,0x3c,0x48,0x87,0x10,0x61,0x26,
+  0x37,0x34,0x03,0xc1,0x26,0x84,0x91,0x03,0xfa,0xf5,0x77,0xc0,0xc7,0xc1,0xd0,0xea,
+  0xd9,0x66,0x91,0xe4,0xef,0x75,0x72,0xb3,0x5d,0x67,0xef,0xfc,0xbe,0x3a,0x37,0x80,
+  0xd5,0x8a,0x02,0xf7,0x16,0xeb,0xdd,0x14,0x25,0x7d,0x1a,0x3b,0xa8,0xab,0x55,0x9e,
+  0x7b,0xa2,0x5d,0xaf,0xce,0x2c,0x80,0x6c,0xbd,0xd5,0x27,0x8e,0x73,0xa6,0xd5,0x39,
+  0x4f,0xfe,0xc6,0x10,0x77,0x33,0x5f,0x3b,0x3d,0xc3,0xc3,0x98,0xaa,0x2f,0xb8,0x9e,
+  0xe8,0xfa,0xd1,0x4a,0x1b,0x65,0x57,0x55,0x12,0x9c,0xd8,0xce,0xd5,0xb8,0xcd,0xdf,
+  0x94,0x70,0xb2,0xa3,0x28,0x06,0x57,0x30,0xd0,0x2d,0xc4,0x84,0x45,0x3c,0x64,0x7c,
+  0xae,0x88,0xa8,0x49,0xe7,0x48,0x7b,0x4a,0x8e,0xc8,0x9a,0xb1,0x1d,0x0f,0x18,0xb4,
+  0xdb,0x80,0x89,0x4d,0x06,0xb9,0x86,0x1e,0x08,0xf8,0x33,0xdc,0x48,0x77,0x83,0x50,
+  0x4e,0xe1,0x7a,0xb7,0x77,0x5a,0x7a,0x7d,0x2e,0x37,0x40,0x6f,0xad,0xbd,0xc6,0x4a,
+  0xd5,0x07,0x59,0x83,0xef,0xf0,0x17,0x5d,0x84,0xbe,0x0d,0xdf,0x3e,0x1c,0xbd,0x0d,
+  0xa1,0xfd,0xcc,0x97,0x45,0x8a,0xd8,0x6b,0x54,0xd6,0x44,0x07,0x11,0x95,0x9c,0xfe,
+  0xe0,0xe3,0x44,0x6d,0xcf,0x7a,0x79,0x6c,0xf6,0xe1,0xe9,0xde,0x5e,0xc6,0xf7,0xee,
+  0x02,0xb3,0x89,0x43,0xdf,0x5a,0xe3,0xd3,0xd7,0x95,0xbf,0x8d,0xd7,0x1b,0x91,0x69,
+  0x9d,0x17,0xe2,0xcd,0xe1,0x69,0x9c,0xe1,0xe1,0x0f,0x1b,0xb1,0x91,0xa0,0xa7,0xa5,
+  0x5f,0x70,0xcd,0xc3,0x52,0xa7,0xa3,0x5b,0x54,0x99,0x8e,0xfe,0x01,0x7d,0xcc,0x16,
+  0x2e,0x58,0x09,0x00,0x00,
+};
+
+// style.css: 203 bytes, 133 bytes gzipped
+const uint8_t asset_style_css_gz[] PROGMEM = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x4b,0xca,0x4f,0xa9,0x54,0xa8,
+  0xe6,0x52,0x50,0x48,0xcb,0xcf,0x2b,0xd1,0x4d,0x4b,0xcc,0xcd,0xcc,0xa9,0xb4,0x52,
+  0x28,0x4b,0x2d,0x4a,0x49,0xcc,0x4b,0xd4,0x51,0x28,0x4e,0xcc,0x2b,0xd6,0x2d,0x4e,
+  0x2d,0xca,0x4c,0xb3,0x06,0xaa,0xc9,0x4d,0x2c,0x4a,0xcf,0xcc,0xb3,0x52,0x30,0xd0,
+  0x33,0x4d,0xcd,0xb5,0xe6,0xaa,0xe5,0xca,0x30,0x22,0x52,0x6f,0x2d,0x57,0x5a,0x7e,
+  0x51,0x2e,0xd1,0x8a,0x33,0xf3,0x0a,0x4a,0x4b,0xa2,0x4b,0x2a,0x0b,0x52,0x6d,0x4b,
+  0x52,0x2b,0x4a,0x62,0x81,0xf2,0xa9,0x39,0xa9,0xc9,0x25,0x60,0x03,0x20,0xae,0xd0,
+  0x4d,0xca,0x2f,0x29,0xc9,0xcf,0x05,0x39,0xc6,0x18,0xe2,0x18,0x00,0x16,0x12,0x18,
+  0xf0,0xcb,0x00,0x00,0x00,
+};
+
+const WiHomeAsset wihome_assets[] = {
+  {"/index.html", "text/html", "\"5affc13b281f0e45\"", "no-cache", asset_index_html_gz, sizeof(asset_index_html_gz)},
+  {"/main.js", "application/javascript", "\"70c40c5cbde86f17\"", "no-cache", asset_main_js_gz, sizeof(asset_main_js_gz)},
+  {"/style.css", "text/css", "\"1e3e9d82ae50f18e\"", "no-cache", asset_style_css_gz, sizeof(asset_style_css_gz)},
+};
+const unsigned int N_wihome_assets = sizeof(wihome_assets)/sizeof(wihome_assets[0]);
+
+#endif // WIHOMEASSETS_H
@@ -0,0 +1,42 @@
+// WiHome Clock Class
+//
+// Time source of WiHomeComm; the default uses millis()/micros(), other
+// implementations can be injected (e.g. a shared clock of a host event loop).
+// WiHomeTimer is an interval timer on such a clock, with the semantics of
+// EnoughTimePassed.
+#include "Arduino.h"
+
+#ifndef WIHOMECLOCK_H
+#define WIHOMECLOCK_H
+
+class WiHomeClock
+{
+  public:
+    virtual ~WiHomeClock() {}
+    virtual unsigned long ms() { return millis(); }
+    virtual unsigned long us() { return micros(); }
+};
+
+class WiHomeTimer
+{
+  private:
+    WiHomeClock* clock;
+    unsigned long interval;
+    unsigned long last_event;
+  public:
+    // The first check is due right away (e.g. findhub as soon as UDP is up):
+    WiHomeTimer(WiHomeClock* _clock, unsigned long _interval)
+      : clock(_clock), interval(_interval), last_event(_clock->ms() - _interval) {}
+    // True once per interval, the interval restarts when it returns true:
+    bool enough_time()
+    {
+      unsigned long now = clock->ms();
+      if (now - last_event < interval)
+        return false;
+      last_event = now;
+      return true;
+    }
+    void event() { last_event = clock->ms(); }
+};
+
+#endif // WIHOMECLOCK_H
@@ -3,29 +3,49 @@
 // Author: Gernot Fattinger (2019-2024)
 
 #include "WiHomeComm.h"
+#include <new>
 
 WiHomeComm::WiHomeComm() // setup WiHomeComm object
 {
-  init(true, true);
+  init(NULL, NULL, NULL, true, true);
 }
 
 WiHomeComm::WiHomeComm(bool _wihome_protocol) // setup WiHomeComm object
 {
-  init(_wihome_protocol, true);
+  init(NULL, NULL, NULL, _wihome_protocol, true);
 }
 
 WiHomeComm::WiHomeComm(bool _wihome_protocol, bool _connect_wifi) // setup WiHomeComm object
 {
-  init(_wihome_protocol, _connect_wifi);
+  init(NULL, NULL, NULL, _wihome_protocol, _connect_wifi);
 }
 
-void WiHomeComm::init(bool _wihome_protocol, bool _connect_wifi)
+WiHomeComm::WiHomeComm(WiHomeNetwork* _network, WiHomeStorage* _storage, WiHomeClock* _clock)
+{
+  init(_network, _storage, _clock, true, true);
+}
+
+WiHomeComm::WiHomeComm(WiHomeNetwork* _network, WiHomeStorage* _storage, WiHomeClock* _clock,
+                       bool _wihome_protocol, bool _connect_wifi)
+{
+  init(_network, _storage, _clock, _wihome_protocol, _connect_wifi);
+}
+
+void WiHomeComm::init(WiHomeNetwork* _network, WiHomeStorage* _storage, WiHomeClock* _clock,
+                      bool _wihome_protocol, bool _connect_wifi)
 {
   main_html = NULL;
+  // Default to the ESP8266 implementations:
+  network = _network ? _network : new WiHomeNetworkESP();
+  clock = _clock ? _clock : new WiHomeClock();
+  wihome_trace.set_clock(clock);
   wihome_protocol = _wihome_protocol;
   connect_wifi = _connect_wifi;
-  Serial.printf("WiHomeComm initializing ...\n");
-  config = new ConfigFileJSON("wihome.cfg");
+  WHLOG_INFO("WiHomeComm initializing ...\n");
+  WHTRACE_BEGIN("init");
+  WHTRACE_BEGIN("ConfigFileJSON");
+  config = _storage ? _storage : new WiHomeConfigFile("wihome.cfg");
+  WHTRACE_END("ConfigFileJSON");
   add_config_parameter(ssid, "ssid","SSID");
   secure_parameter("ssid");
   add_config_parameter(password, "password","Password");
@@ -36,9 +56,9 @@ void WiHomeComm::init(bool _wihome_protocol, bool _connect_wifi)
   secure_parameter("homekit_reset");
   if (config->is_valid_file())
   {
-    Serial.printf("Loading user data from SPIFFS file:\n");
+    WHLOG_INFO("Loading user data from SPIFFS file:\n");
     LoadUserData();
-    Serial.printf("SSID: %s, password: %s, client: %s\n",ssid,password,client);
+    WHLOG_INFO("SSID: %s, password: %s, client: %s\n", ssid, WHLOG_SECRET(password), client);
   }
   else
   {
@@ -47,15 +67,25 @@ void WiHomeComm::init(bool _wihome_protocol, bool _connect_wifi)
   }
   strcpy(ssid_softAP, "WiHome_SoftAP");
   hubip = IPAddress(0,0,0,0);
-  etp_Wifi = new EnoughTimePassed(WIHOMECOMM_WAITFOR_CONNECT_INTERVAL);
+  etp_Wifi = new WiHomeTimer(clock, WIHOMECOMM_WAITFOR_CONNECT_INTERVAL);
+  etp_events = new WiHomeTimer(clock, WIHOMECOMM_EVENT_KEEPALIVE_INTERVAL);
+  etp_rssi = new WiHomeTimer(clock, WIHOMECOMM_RSSI_INTERVAL);
+  etp_roam_scan = new WiHomeTimer(clock, WIHOMECOMM_ROAM_SCAN_INTERVAL);
+  ota.begin(clock);
+  ota.on_start = std::bind(&WiHomeComm::PauseForUpdate, this);
+  sync.begin(clock);
+  network_scan.begin(clock);
   connect_state = WH_INIT;
+  WHTRACE_END("init");
 }
 
 byte WiHomeComm::status()
 {
   // 4: SoftAP mode, 3: WiFi not connected, 2: WiFi connected but hub not found,
   // 1: WiFi connected and hub found, 0: unknown problem
-  if (WiFi.getMode()==WIFI_STA)
+  if (live_config)
+    return WIHOMECOMM_SOFTAP;
+  if (network->station_mode())
   {
     if (connect_state == WH_CONNECTED)
     {
@@ -67,7 +97,7 @@ byte WiHomeComm::status()
     else
       return WIHOMECOMM_DISCONNECTED;
   }
-  else if (WiFi.getMode()==WIFI_AP)
+  else if (network->softap_mode())
     return WIHOMECOMM_SOFTAP;
   else
     return WIHOMECOMM_UNKNOWN;
@@ -164,8 +194,7 @@ void WiHomeComm::check_button()
 
 void WiHomeComm::check()
 {
-  DynamicJsonDocument doc(128);
-  check(doc);
+  check(rx_doc);
 }
 
 void WiHomeComm::check(DynamicJsonDocument& doc)
@@ -174,11 +203,20 @@ void WiHomeComm::check(DynamicJsonDocument& doc)
   check_button();
   if (softAPmode==false)
   {
+    if (live_config)
+      StopLiveConfig();
     if (ConnectStation() && wihome_protocol)
       serve_packet(doc);
   }
+  else if (live_config || (allow_live_config && connect_state == WH_CONNECTED && network->has_web_server()))
+  {
+    // Station is up: run the config portal next to it instead of tearing it down
+    if (ConnectLiveConfig() && wihome_protocol)
+      serve_packet(doc);
+  }
   else
     ConnectSoftAP();
+  wihome_log.drain();
 }
 
 bool WiHomeComm::ConnectStation()
@@ -187,131 +225,227 @@ bool WiHomeComm::ConnectStation()
   switch (connect_state)
   {
     case WH_INIT:
+      // The config portal can not outlive the station connection it runs next to:
+      if (live_config)
+        StopLiveConfig();
+      // Close the spans reconnect() or a failed roam interrupted:
+      if (trace_span)
+        WHTRACE_ASYNC_END(trace_span, "interrupted");
+      trace_span = NULL;
+      if (tracing_discovery)
+        WHTRACE_ASYNC_END("hub_discovery", "interrupted");
+      tracing_discovery = false;
       hub_discovered = false;
+      softap_up = false;
+      rssi_valid = false;
+      if (roam_scanning)
+        network->scan_delete();
+      roam_scanning = false;
+      ota.abort(network);
+      sync.reset(); // The hub or the path to it may change
+      hub_clock = false;
+      N_fast_findhub = 0;
       connect_state = WH_STOP_SOFTAP;
       break;
     case WH_STOP_SOFTAP:
       DestroyConfigWebServer();
-      if (WiFi.getMode() == WIFI_AP)
+      if (network->softap_mode())
       {
-        if (WiFi.softAPdisconnect(true))
+        if (network->stop_softap())
         {
           connect_state = WH_STOP_MDNS;
-          Serial.println("Stopped softAP mode.");
+          WHLOG_INFO("Stopped softAP mode.\n");
         }
         else
-          connect_state = WH_ERROR;
+          EnterErrorState();
       }
       else
         connect_state = WH_STOP_MDNS;
       break;
     case WH_STOP_MDNS:
-      if (wihome_protocol && MDNS.isRunning())
+      if (wihome_protocol && network->mdns_running())
       {
-        Serial.println("Running mDNS responder detected.");
-        if (MDNS.removeService("esp"))
-          Serial.println("mDNS service 'esp' stopped.");
-        if (MDNS.end())
+        WHLOG_DEBUG("Running mDNS responder detected.\n");
+        if (network->stop_mdns())
         {
-          Serial.println("mDNS responder stopped.");
+          WHLOG_INFO("mDNS responder stopped.\n");
           connect_state = WH_STOP_UDP;
         }
         else
         {
-          Serial.println("[ERROR] Could not stop mDNS responder.");
-          connect_state = WH_ERROR;
+          WHLOG_ERROR("[ERROR] Could not stop mDNS responder.\n");
+          EnterErrorState();
         }
       }
       else
         connect_state = WH_STOP_UDP;
       break;
     case WH_STOP_UDP:
-      if (wihome_protocol)
-      {
-        Udp.stop();
-        if (etp_findhub)
-          delete etp_findhub;
-        etp_findhub = NULL;
-        hub_discovered = false;
-        Serial.println("UDP services stopped.");
-      }
+      StopUdp();
       connect_state = WH_STOP_STA;
       break;
     case WH_STOP_STA:
-      Serial.println("WH_STOP_STA");
-      WiFi.setAutoReconnect(false);
-      WiFi.disconnect(true);
-      if (!WiFi.isConnected() && WiFi.getMode() == WIFI_OFF)
+      WHLOG_DEBUG("WH_STOP_STA\n");
+      if (network->stop_station())
         connect_state = WH_START_STA; // everything should be disconnected and turned off at this point
       else
-        connect_state = WH_ERROR;
-      Serial.println("WH_STOP_STA end");
+        EnterErrorState();
+      WHLOG_DEBUG("WH_STOP_STA end\n");
       break;
     case WH_START_STA:
       if (connect_wifi)
       {  
-        Serial.printf("Connecting to %s with password %s ",ssid, password);
-        WiFi.begin(ssid,password);
-        WiFi.hostname(client);
-        WiFi.setAutoReconnect(true);
+        WHLOG_INFO("Connecting to %s with password %s ", ssid, WHLOG_SECRET(password));
+        WHTRACE_ASYNC_BEGIN("connect_station", ssid);
+        trace_span = "connect_station";
+        network->start_station(ssid, password, client);
         connect_state = WH_WAITFOR_STA;
       }
       else
         connect_state = WH_NO_WIFI;
       break;
     case WH_WAITFOR_STA:
-      if (WiFi.status() == WL_CONNECTED && WiFi.getMode() == WIFI_STA)
+      if (network->station_connected())
       {
-        Serial.printf("\nConnected to station (IP=%s, name=%s).\n",
-                      WiFi.localIP().toString().c_str(), WiFi.hostname().c_str());
+        WHLOG_INFO("\nConnected to station (IP=%s, name=%s).\n",
+                      network->local_ip().toString().c_str(), network->hostname().c_str());
+        WHTRACE_ASYNC_END("connect_station", ssid);
+        trace_span = NULL;
         connect_state = WH_START_MDNS;
       }
       else if (etp_Wifi->enough_time())
-        Serial.printf(".");
+        WHLOG_DEBUG(".");
       break;
     case WH_START_MDNS:
       if (wihome_protocol)
       {
-        if (MDNS.begin(client))
+        WHTRACE_BEGIN("MDNS.begin");
+        bool mdns_started = network->start_mdns(client);
+        WHTRACE_END("MDNS.begin");
+        if (mdns_started)
         {
-          Serial.println("mDNS responder started.");
-          MDNS.addService("esp", "tcp", 8080); // Announce esp tcp service on port 8080
+          WHLOG_INFO("mDNS responder started.\n");
           connect_state = WH_START_OTA;
         }
         else
         {
-          Serial.println("Error setting up MDNS responder!");
-          connect_state = WH_ERROR;
+          WHLOG_ERROR("Error setting up MDNS responder!\n");
+          EnterErrorState();
         }
       }
       else
         connect_state = WH_START_OTA;
       break;
     case WH_START_OTA:
-      ArduinoOTA.setPort(8266);
-      ArduinoOTA.setHostname(client);
-      ArduinoOTA.begin();
-      Serial.println("OTA service started.");
+      WHTRACE_BEGIN("ArduinoOTA.begin");
+      network->start_ota(client, ota_password, &ota);
+      WHTRACE_END("ArduinoOTA.begin");
+      WHLOG_INFO("OTA service started.\n");
       connect_state = WH_START_UDP;
       break;
     case WH_START_UDP:
       if (wihome_protocol)
       {
-        Udp.begin(localUdpPort);
-        etp_findhub = new EnoughTimePassed(WIHOMECOMM_FINDHUB_INTERVAL);
-        Serial.println("UDP services created.");
+        WHTRACE_BEGIN("Udp.begin");
+        wihome_heap.begin(WH_HEAP_UDP);
+        network->begin_udp(localUdpPort);
+        wihome_heap.end(WH_HEAP_UDP);
+        WHTRACE_END("Udp.begin");
+        WHTRACE_ASYNC_BEGIN("hub_discovery");
+        tracing_discovery = true;
+        etp_findhub = new (etp_findhub_storage) WiHomeTimer(clock, WIHOMECOMM_FINDHUB_INTERVAL);
+        WHLOG_INFO("UDP services created.\n");
       }
       connect_state = WH_CONNECTED;
       break;
     case WH_CONNECTED:
-      ArduinoOTA.handle();
+      network->handle_ota();
+      if (connect_state != WH_CONNECTED) // An update started and paused the services
+        break;
       if (wihome_protocol)
         findhub();
+      CheckLink();
       break;
     case WH_NO_WIFI:
       break;
+    case WH_ROAM:
+    {
+      // Reassociate with the stronger access point found by CheckRoamScan(), keeping
+      // mDNS, OTA, UDP and the web server in place:
+      char str[18];
+      snprintf(str, sizeof(str), "%02X:%02X:%02X:%02X:%02X:%02X",
+               roam_bssid[0], roam_bssid[1], roam_bssid[2], roam_bssid[3], roam_bssid[4], roam_bssid[5]);
+      WHLOG_INFO("Roaming to %s (channel %d).\n", str, roam_channel);
+      WHTRACE_ASYNC_BEGIN("roam", ssid);
+      trace_span = "roam";
+      roam_ip = network->local_ip();
+      roam_start = clock->ms();
+      network->roam_station(ssid, password, roam_bssid, roam_channel);
+      connect_state = WH_WAITFOR_ROAM;
+      break;
+    }
+    case WH_WAITFOR_ROAM:
+      if (network->station_connected())
+      {
+        uint8_t current[6];
+        network->bssid(current);
+        if (memcmp(current, roam_bssid, 6) == 0)
+        {
+          WHTRACE_ASYNC_END("roam", ssid);
+          trace_span = NULL;
+          network->release_bssid();
+          rssi_valid = false;
+          if (network->local_ip() == roam_ip)
+          {
+            N_roams++;
+            WHLOG_INFO("Roaming completed.\n");
+            connect_state = WH_CONNECTED;
+          }
+          else
+          {
+            // The new access point handed out a different address, services have to be rebound:
+            N_roams++;
+            WHLOG_WARN("Roaming changed IP to %s, reconnecting.\n", network->local_ip().toString().c_str());
+            connect_state = WH_INIT;
+          }
+          break;
+        }
+      }
+      if (clock->ms() - roam_start > WIHOMECOMM_ROAM_TIMEOUT)
+      {
+        WHTRACE_ASYNC_END("roam", "timeout");
+        trace_span = NULL;
+        N_roam_failures++;
+        rssi_valid = false;
+        WHLOG_WARN("Roaming timed out, reconnecting.\n");
+        connect_state = WH_INIT;
+      }
+      break;
+    case WH_UPDATE:
+      network->handle_ota();
+      ota.check(network);
+      if (ota.state == WH_OTA_DONE)
+      {
+        WHLOG_INFO("Firmware update completed, restarting.\n");
+        wihome_log.flush();
+        network->restart();
+        connect_state = WH_INIT; // Only reached on hosts without a real restart
+      }
+      else if (!ota.active())
+      {
+        WHLOG_WARN("Firmware update failed (%s), resuming services.\n", ota.error);
+        connect_state = WH_START_UDP;
+      }
+      break;
+    case WH_ERROR:
+      if (clock->ms() - error_start > WIHOMECOMM_ERROR_RETRY)
+      {
+        WHLOG_INFO("Retrying to connect.\n");
+        connect_state = WH_INIT;
+      }
+      break;
   }
-  if (connect_state == WH_CONNECTED)
+  if (connect_state == WH_CONNECTED && !live_config && network->has_web_server())
   {
     if (!main_webserver)
     {
@@ -320,20 +454,223 @@ bool WiHomeComm::ConnectStation()
       CreateMainWebServer(80);
     }
     else
+    {
       handleClientMain();
+      CheckEvents();
+      if (pending_update_url.length() > 0)
+      {
+        String url = pending_update_url;
+        pending_update_url.clear();
+        update_from(url.c_str());
+      }
+    }
   }
   if ((connect_state == WH_CONNECTED) || (connect_state == WH_NO_WIFI))
     return true;
   return false;
 }
 
+void WiHomeComm::EnterErrorState()
+{
+  // A step of the connection sequence failed; start over after a pause:
+  WHLOG_ERROR("[ERROR] Connection step %d failed.\n", (int) connect_state);
+  error_start = clock->ms();
+  connect_state = WH_ERROR;
+}
+
+void WiHomeComm::StopUdp()
+{
+  if (wihome_protocol)
+  {
+    wihome_heap.begin(WH_HEAP_UDP);
+    network->stop_udp();
+    wihome_heap.end(WH_HEAP_UDP);
+    if (tracing_discovery)
+      WHTRACE_ASYNC_END("hub_discovery", "stopped");
+    tracing_discovery = false;
+    if (etp_findhub)
+      etp_findhub->~WiHomeTimer();
+    etp_findhub = NULL;
+    hub_discovered = false;
+    WHLOG_INFO("UDP services stopped.\n");
+  }
+}
+
+void WiHomeComm::PauseForUpdate()
+{
+  // Called from ArduinoOTA.handle() or update_from() in WH_CONNECTED; the update gets
+  // the network and the heap to itself until it completes or fails:
+  WHLOG_INFO("Firmware update started, pausing services.\n");
+  if (live_config)
+  {
+    // An ArduinoOTA push can arrive while the live config portal runs; it is closed
+    // and the device returns to station mode:
+    StopLiveConfig();
+    softAPmode = false;
+  }
+  DestroyMainWebServer();
+  StopUdp();
+  if (roam_scanning)
+    network->scan_delete();
+  roam_scanning = false;
+  connect_state = WH_UPDATE;
+}
+
+bool WiHomeComm::update_from(const char* url)
+{
+  if (connect_state != WH_CONNECTED || live_config)
+    return false;
+  return ota.pull(url);
+}
+
+bool WiHomeComm::update_in_progress()
+{
+  return ota.active();
+}
+
+unsigned int WiHomeComm::get_update_progress()
+{
+  return ota.progress();
+}
+
+unsigned long WiHomeComm::get_update_throughput()
+{
+  return ota.throughput();
+}
+
+bool WiHomeComm::is_clock_synchronized()
+{
+  return sync.synchronized();
+}
+
+uint64_t WiHomeComm::get_hub_time()
+{
+  return sync.synchronized() ? sync.hub_us() : 0;
+}
+
+int64_t WiHomeComm::get_clock_offset()
+{
+  return sync.get_offset();
+}
+
+double WiHomeComm::get_clock_drift()
+{
+  return sync.get_drift();
+}
+
+uint32_t WiHomeComm::get_round_trip()
+{
+  return sync.round_trip;
+}
+
+int32_t WiHomeComm::get_uplink_latency()
+{
+  return sync.uplink;
+}
+
+int32_t WiHomeComm::get_downlink_latency()
+{
+  return sync.downlink;
+}
+
+void WiHomeComm::CheckLink()
+{
+  if (etp_rssi->enough_time())
+  {
+    int32_t rssi = network->rssi();
+    if (rssi < 0 && rssi >= -127) // The ESP8266 reports 31 without a valid measurement
+    {
+      if (rssi_valid)
+        rssi_ewma += WIHOMECOMM_RSSI_EWMA_ALPHA * (rssi - rssi_ewma);
+      else
+        rssi_ewma = rssi;
+      rssi_valid = true;
+      rssi_history[N_rssi_samples % WIHOMECOMM_RSSI_HISTORY] = rssi;
+      N_rssi_samples++;
+      WHLOG_DEBUG("RSSI %d dBm (average %d dBm).\n", rssi, (int) rssi_ewma);
+    }
+    if (allow_roaming && rssi_valid && !roam_scanning && !softAPmode
+        && rssi_ewma < WIHOMECOMM_ROAM_THRESHOLD && etp_roam_scan->enough_time())
+    {
+      if (network->start_scan())
+      {
+        roam_scanning = true;
+        N_roam_scans++;
+        WHLOG_INFO("Weak link (%d dBm), scanning for access points.\n", (int) rssi_ewma);
+      }
+    }
+  }
+  if (roam_scanning)
+    CheckRoamScan();
+}
+
+void WiHomeComm::CheckRoamScan()
+{
+  int N = network->scan_complete();
+  if (N == WIHOMENETWORK_SCAN_RUNNING)
+    return;
+  roam_scanning = false;
+  if (N == WIHOMENETWORK_SCAN_FAILED)
+  {
+    WHLOG_WARN("Access point scan failed.\n");
+    return;
+  }
+  uint8_t current[6];
+  network->bssid(current);
+  int32_t best_rssi = -128;
+  WiHomeScanResult result;
+  for (int n=0; n<N; n++)
+    if (network->scan_result(n, &result) && strcmp(result.ssid, ssid) == 0
+        && memcmp(result.bssid, current, 6) != 0 && result.rssi > best_rssi)
+    {
+      best_rssi = result.rssi;
+      memcpy(roam_bssid, result.bssid, 6);
+      roam_channel = result.channel;
+    }
+  network->scan_delete();
+  if (best_rssi >= rssi_ewma + WIHOMECOMM_ROAM_HYSTERESIS)
+    connect_state = WH_ROAM;
+  else
+    WHLOG_INFO("No stronger access point found.\n");
+}
+
+int WiHomeComm::get_rssi()
+{
+  if (!rssi_valid)
+    return 0;
+  return (int) (rssi_ewma - 0.5);
+}
+
+unsigned int WiHomeComm::get_rssi_history(int* target, unsigned int size)
+{
+  unsigned int N = N_rssi_samples < WIHOMECOMM_RSSI_HISTORY ? N_rssi_samples : WIHOMECOMM_RSSI_HISTORY;
+  if (N > size)
+    N = size;
+  for (unsigned int n=0; n<N; n++)
+    target[n] = rssi_history[(N_rssi_samples - N + n) % WIHOMECOMM_RSSI_HISTORY];
+  return N;
+}
+
+unsigned long WiHomeComm::get_roam_count()
+{
+  return N_roams;
+}
+
+unsigned long WiHomeComm::get_roam_failures()
+{
+  return N_roam_failures;
+}
+
 void WiHomeComm::ConnectSoftAP()
 {
   connect_state = WH_INIT;
-  if (WiFi.status()!=WL_DISCONNECTED || WiFi.getMode()!=WIFI_AP)
+  // The portal scan switches the radio to AP+STA, so the exact mode can not tell
+  // whether the soft AP has been set up already:
+  if (!softap_up || !network->softap_mode())
   {
     hub_discovered = false;
-    Serial.printf("Going to SoftAP mode:\n");
+    softap_up = false;
+    WHLOG_INFO("Going to SoftAP mode:\n");
     WiFi.softAPdisconnect(true);
     if (WiFi.isConnected())
       WiFi.disconnect(true);
@@ -346,13 +683,17 @@ void WiHomeComm::ConnectSoftAP()
     WiFi.softAPConfig(apIP, apIP, netMsk);
     if (WiFi.softAP(ssid_softAP))
     {
-      Serial.printf("Soft AP created!\n");
-      Serial.printf("SoftAP IP: %s\n",WiFi.softAPIP().toString().c_str());
-      Serial.printf("Status/Mode: %d/%d\n",WiFi.status(),WiFi.getMode());
+      softap_up = true;
+      WHLOG_INFO("Soft AP created!\n");
+      WHLOG_INFO("SoftAP IP: %s\n", WiFi.softAPIP().toString().c_str());
+      WHLOG_DEBUG("Status/Mode: %d/%d\n", WiFi.status(), WiFi.getMode());
+      // Scan in the background while the portal comes up (the core enables the
+      // station interface for it, the soft AP keeps running):
+      network_scan.start(network);
     }
     else
     {
-      Serial.printf("Soft AP creation FAILED.\n");
+      WHLOG_ERROR("Soft AP creation FAILED.\n");
     }
   }
   else
@@ -364,10 +705,64 @@ void WiHomeComm::ConnectSoftAP()
       CreateConfigWebServer(80);
     }
     else
+    {
+      CheckNetworkScan();
       handleClientConfig();
+    }
   }
 }
 
+bool WiHomeComm::ConnectLiveConfig()
+{
+  if (!live_config)
+  {
+    WHLOG_INFO("Going to AP+STA config mode:\n");
+    live_config = true;
+    DestroyMainWebServer();
+    if (network->start_softap_station(ssid_softAP))
+      WHLOG_INFO("Soft AP created (IP: %s), station stays connected.\n",
+                    network->softap_ip().toString().c_str());
+    else
+      WHLOG_ERROR("Soft AP creation FAILED.\n");
+    CreateConfigWebServer(80);
+    // The roaming scan would consume the results of the portal scan:
+    if (roam_scanning)
+      network->scan_delete();
+    roam_scanning = false;
+    network_scan.start(network);
+  }
+  else
+  {
+    CheckNetworkScan();
+    handleClientConfig();
+  }
+  // Keep station, OTA and UDP services running:
+  return ConnectStation();
+}
+
+void WiHomeComm::StopLiveConfig()
+{
+  DestroyConfigWebServer();
+  if (network->stop_softap_station())
+    WHLOG_INFO("Stopped AP+STA config mode.\n");
+  live_config = false;
+}
+
+static void AppendEscaped(String &html, const char* str)
+{
+  // SSIDs are arbitrary bytes, keep them from breaking the markup:
+  for (; *str; str++)
+    switch (*str)
+    {
+      case '&': html += "&amp;"; break;
+      case '<': html += "&lt;"; break;
+      case '>': html += "&gt;"; break;
+      case '\'': html += "&#39;"; break;
+      case '"': html += "&quot;"; break;
+      default: html += *str;
+    }
+}
+
 void WiHomeComm::AddFormItems(String &html, bool show_secure)
 {
   if (N_config_paras>0)
@@ -396,6 +791,31 @@ void WiHomeComm::AddFormItems(String &html, bool show_secure)
         }
         else
         {
+          if (show_secure && strcmp(pNames[n], "ssid")==0 && network_scan.size()>0)
+          {
+            // Networks from the last scan, strongest first; picking one fills in the
+            // text field below, which stays editable for hidden networks:
+            html += "<br><select onchange='if(this.value)this.form.ssid.value=this.value'>";
+            html += "<option value=''>Networks in range</option>";
+            for (unsigned int m=0; m<network_scan.size(); m++)
+            {
+              const WiHomeScanResult& result = network_scan.network(m);
+              html += "<option value='";
+              AppendEscaped(html, result.ssid);
+              html += "'";
+              if (strcmp(str, result.ssid)==0)
+                html += " selected";
+              html += ">";
+              AppendEscaped(html, result.ssid);
+              html += " (";
+              html += result.rssi;
+              html += " dBm";
+              if (!result.secure)
+                html += ", open";
+              html += ")</option>";
+            }
+            html += "</select>";
+          }
           html += "<br><input type='text' name='";
           html += pNames[n];
           html += "' value='";
@@ -406,49 +826,174 @@ void WiHomeComm::AddFormItems(String &html, bool show_secure)
     }
 }
 
+void WiHomeComm::CreateWebServer(int port)
+{
+  // One server for the config and the main mode, set up once: the routes dispatch on
+  // the current mode, so mode changes only stop and start listening and do not
+  // allocate handlers again. The port of the first call applies.
+  if (webserver)
+    return;
+  webserver = new (webserver_storage) ESP8266WebServer(port);
+  webserver->on("/", std::bind(&WiHomeComm::handleRoot, this));
+  webserver->onNotFound(std::bind(&WiHomeComm::handleRoot, this));
+  for (unsigned int n=0; n<sizeof(captive_probe_uris)/sizeof(captive_probe_uris[0]); n++)
+    webserver->on(captive_probe_uris[n], std::bind(&WiHomeComm::handleCaptiveProbe, this));
+  for (unsigned int n=0; n<N_wihome_assets; n++)
+    webserver->on(wihome_assets[n].uri, std::bind(&WiHomeComm::handleAsset, this, &wihome_assets[n]));
+  const char* headers[] = {"If-None-Match"}; // for conditional requests of static assets
+  webserver->collectHeaders(headers, 1);
+  // Config portal:
+  OnMode("/save_and_restart.php", true, &WiHomeComm::handleSaveAndRestartConfig);
+  OnMode("/networks.json", true, &WiHomeComm::handleNetworksConfig);
+  // Main mode:
+  OnMode("/values.json", false, &WiHomeComm::handleValuesMain);
+  OnMode("/events", false, &WiHomeComm::handleEventsMain);
+  OnMode("/trace.json", false, &WiHomeComm::handleTraceMain);
+  OnMode("/heap.json", false, &WiHomeComm::handleHeapMain);
+  OnMode("/link.json", false, &WiHomeComm::handleLinkMain);
+  OnMode("/ota.json", false, &WiHomeComm::handleOTAMain);
+  OnMode("/sync.json", false, &WiHomeComm::handleSyncMain);
+  OnMode("/update", false, &WiHomeComm::handleUpdateMain);
+  // webserver->on("/save.php", std::bind(&WiHomeComm::handleSaveMain, this));
+}
+
+void WiHomeComm::OnMode(const char* uri, bool config_mode, void (WiHomeComm::*handler)())
+{
+  // Outside of its mode a route answers like an unknown URI:
+  webserver->on(uri, [this, config_mode, handler]() {
+    if ((config_webserver != NULL) == config_mode)
+      (this->*handler)();
+    else
+      handleRoot();
+  });
+}
+
+void WiHomeComm::handleRoot()
+{
+  if (config_webserver)
+    handleRootConfig();
+  else
+    handleRootMain();
+}
+
+void WiHomeComm::handleAsset(const WiHomeAsset* asset)
+{
+  // The config portal only needs the style sheet:
+  if (config_webserver && strcmp(asset->uri, "/style.css") != 0)
+    handleRootConfig();
+  else
+    sendAsset(webserver, asset);
+}
+
 void WiHomeComm::CreateConfigWebServer(int port)
 {
   // Setup the DNS server redirecting all the domains to the apIP
   IPAddress apIP(192, 168, 4, 1);
-  dnsServer = new DNSServer();
+  wihome_heap.begin(WH_HEAP_DNS);
+  if (!dnsServer)
+    dnsServer = new (dnsserver_storage) DNSServer();
   dnsServer->start(DNS_PORT, "*", apIP);
-  config_webserver = new ESP8266WebServer(port);
-  config_webserver->on("/", std::bind(&WiHomeComm::handleRootConfig, this));
-  config_webserver->onNotFound(std::bind(&WiHomeComm::handleRootConfig, this));
-  config_webserver->on("/save_and_restart.php", std::bind(&WiHomeComm::handleSaveAndRestartConfig, this));
-  config_webserver->begin();
-  Serial.println("HTTP server started.");
+  wihome_heap.end(WH_HEAP_DNS);
+  wihome_heap.begin(WH_HEAP_WEB);
+  CreateWebServer(port);
+  webserver->begin();
+  config_webserver = webserver;
+  wihome_heap.end(WH_HEAP_WEB);
+  WHLOG_INFO("HTTP server started.\n");
 }
 
 void WiHomeComm::DestroyConfigWebServer()
 {
   if(config_webserver)
   {
+    wihome_heap.begin(WH_HEAP_WEB);
     config_webserver->stop();
-    delete config_webserver;
     config_webserver = NULL;
-    Serial.println("Destroyed web server.");
-  }
-  if (dnsServer)
-  {
+    wihome_heap.end(WH_HEAP_WEB);
+    wihome_heap.begin(WH_HEAP_DNS);
     dnsServer->stop();
-    delete dnsServer;
-    dnsServer = NULL;
-    Serial.println("Destroyed DNS server.");
+    wihome_heap.end(WH_HEAP_DNS);
+    WHLOG_INFO("Stopped web and DNS server.\n");
   }
+  network_scan.cancel(network);
+  InvalidateConfigPage();
 }
 
 void WiHomeComm::handleRootConfig()
 {
-  LoadUserData();
-  String html = html_config_form_begin;
-  AddFormItems(html, true);
-  html += html_config_form_end;
-    config_webserver->send(200, "text/html", html);
+  // Stale scan results are refreshed in the background, the page is served right away:
+  network_scan.start(network);
+  // Render the form only once; it is re-rendered after a config parameter changed
+  // or a scan completed. The parameters in RAM are current (the sketch may have
+  // changed them at runtime without saving), so they are not reloaded:
+  if (!config_html)
+  {
+    wihome_heap.begin(WH_HEAP_CONFIG_PAGE);
+    config_html = new String(html_config_form_begin);
+    AddFormItems(*config_html, true);
+    *config_html += html_config_form_end;
+    wihome_heap.end(WH_HEAP_CONFIG_PAGE);
+  }
+  config_webserver->send(200, "text/html", *config_html);
+}
+
+void WiHomeComm::handleCaptiveProbe()
+{
+  if (!config_webserver)
+  {
+    handleRootMain();
+    return;
+  }
+  config_webserver->sendHeader("Location", captive_portal_url, true);
+  config_webserver->send(302, "text/html", html_captive_redirect);
+}
+
+void WiHomeComm::handleNetworksConfig()
+{
+  network_scan.start(network);
+  DynamicJsonDocument doc(256 + 128 * network_scan.size());
+  doc["scanning"] = network_scan.scanning();
+  doc["age"] = network_scan.scans ? network_scan.age() : 0;
+  JsonArray networks = doc.createNestedArray("networks");
+  for (unsigned int n=0; n<network_scan.size(); n++)
+  {
+    const WiHomeScanResult& result = network_scan.network(n);
+    JsonObject item = networks.createNestedObject();
+    item["ssid"] = (const char*) result.ssid;
+    item["rssi"] = result.rssi;
+    item["channel"] = result.channel;
+    item["secure"] = result.secure;
+  }
+  String json;
+  serializeJson(doc, json);
+  config_webserver->sendHeader("Cache-Control", "no-store");
+  config_webserver->send(200, "application/json", json);
+}
+
+void WiHomeComm::CheckNetworkScan()
+{
+  if (network_scan.check(network))
+    InvalidateConfigPage();
+}
+
+void WiHomeComm::InvalidateConfigPage()
+{
+  if (config_html)
+  {
+    wihome_heap.begin(WH_HEAP_CONFIG_PAGE);
+    delete config_html;
+    config_html = NULL;
+    wihome_heap.end(WH_HEAP_CONFIG_PAGE);
+  }
 }
 
 void WiHomeComm::handleSaveAndRestartConfig()
 {
+  // Remember settings that need a new station connection when changed:
+  char _ssid[32], _password[32], _client[32];
+  strcpy(_ssid, ssid);
+  strcpy(_password, password);
+  strcpy(_client, client);
   String message = "Save and Restart\n\n";
   homekit_reset = false;
   message += "URI: ";
@@ -469,37 +1014,55 @@ void WiHomeComm::handleSaveAndRestartConfig()
   }
   SaveUserData();
   message += "Userdata saved.\n";
-  Serial.println("Userdata saved.");
+  WHLOG_INFO("Userdata saved.\n");
   config_webserver->send(200, "text/plain", message);
-  delay(500);
   softAPmode = false;
+  if (live_config)
+  {
+    // Parameters are applied already; only reconnect if the station settings changed:
+    if (strcmp(_ssid, ssid) || strcmp(_password, password) || strcmp(_client, client))
+    {
+      WHLOG_INFO("Station settings changed, reconnecting.\n");
+      connect_state = WH_INIT;
+    }
+    return;
+  }
+  wihome_log.flush();
+  delay(500);
   ESP.restart();
 }
 
 void WiHomeComm::handleClientConfig()
 {
-  dnsServer->processNextRequest();
-  config_webserver->handleClient();
+  if (!config_webserver)
+    return;
+  // Phones send bursts of DNS lookups and probes, so serve more than one per call:
+  for (int n=0; n<WIHOMECOMM_DNS_MAX_REQUESTS; n++)
+    dnsServer->processNextRequest();
+  for (int n=0; n<WIHOMECOMM_HTTP_MAX_CLIENTS; n++)
+    config_webserver->handleClient();
 }
 
 void WiHomeComm::CreateMainWebServer(int port)
 {
-  main_webserver = new ESP8266WebServer(port);
-  main_webserver->on("/", std::bind(&WiHomeComm::handleRootMain, this));
-  main_webserver->onNotFound(std::bind(&WiHomeComm::handleRootMain, this));
-  // main_webserver->on("/save.php", std::bind(&WiHomeComm::handleSaveMain, this));
-  main_webserver->begin();
-  Serial.println("HTTP main server started.");
+  wihome_heap.begin(WH_HEAP_WEB);
+  CreateWebServer(port);
+  webserver->begin();
+  main_webserver = webserver;
+  wihome_heap.end(WH_HEAP_WEB);
+  WHLOG_INFO("HTTP main server started.\n");
 }
 
 void WiHomeComm::DestroyMainWebServer()
 {
+  StopEvents();
   if(main_webserver)
   {
+    wihome_heap.begin(WH_HEAP_WEB);
     main_webserver->stop();
-    delete main_webserver;
     main_webserver = NULL;
-    Serial.println("Destroyed main web server.");
+    wihome_heap.end(WH_HEAP_WEB);
+    WHLOG_INFO("Stopped main web server.\n");
   }
 }
 
@@ -522,20 +1085,233 @@ void WiHomeComm::handleRootMain()
             update_config_parameter(n, (main_webserver->arg(i)).c_str());   
     }
     SaveUserData();
-    Serial.println("Userdata saved.");
+    WHLOG_INFO("Userdata saved.\n");
   }
-  // Display web page with form:
-  LoadUserData();
-  String html = html_main_begin;
-  html += "Client: ";
-  html += client;
-  html += "<br>";
+  // Display static page shell, which loads the values from /values.json:
+  sendAsset(main_webserver, find_asset("/index.html"));
+}
+
+void WiHomeComm::handleValuesMain()
+{
+  DynamicJsonDocument doc(WIHOMECOMM_VALUES_JSON_SIZE);
+  AssembleValuesJSON(doc);
+  String json;
+  serializeJson(doc, json);
+  main_webserver->sendHeader("Cache-Control", "no-store");
+  main_webserver->send(200, "application/json", json);
+}
+
+void WiHomeComm::handleTraceMain()
+{
+  // Sent in chunks, one per event, to avoid assembling the whole document:
+  char str[WIHOMETRACE_EVENT_SIZE];
+  main_webserver->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  main_webserver->send(200, "application/json", "");
+  main_webserver->sendContent(wihome_trace.json_prefix());
+  for (unsigned int n=0; n<wihome_trace.size(); n++)
+  {
+    wihome_trace.format_event(n, str, sizeof(str));
+    main_webserver->sendContent(str);
+  }
+  main_webserver->sendContent(wihome_trace.json_suffix());
+  main_webserver->sendContent("");
+}
+
+void WiHomeComm::handleHeapMain()
+{
+  char str[512];
+  wihome_heap.format_json(str, sizeof(str));
+  main_webserver->sendHeader("Cache-Control", "no-store");
+  main_webserver->send(200, "application/json", str);
+}
+
+void WiHomeComm::handleLinkMain()
+{
+  DynamicJsonDocument doc(512);
+  doc["rssi"] = get_rssi();
+  uint8_t current[6];
+  network->bssid(current);
+  char str[18];
+  snprintf(str, sizeof(str), "%02X:%02X:%02X:%02X:%02X:%02X",
+           current[0], current[1], current[2], current[3], current[4], current[5]);
+  doc["bssid"] = str;
+  doc["roams"] = N_roams;
+  doc["roam_failures"] = N_roam_failures;
+  doc["roam_scans"] = N_roam_scans;
+  JsonArray history = doc.createNestedArray("history");
+  int samples[WIHOMECOMM_RSSI_HISTORY];
+  unsigned int N = get_rssi_history(samples, WIHOMECOMM_RSSI_HISTORY);
+  for (unsigned int n=0; n<N; n++)
+    history.add(samples[n]);
+  String json;
+  serializeJson(doc, json);
+  main_webserver->sendHeader("Cache-Control", "no-store");
+  main_webserver->send(200, "application/json", json);
+}
+
+void WiHomeComm::handleOTAMain()
+{
+  char str[256];
+  ota.format_json(str, sizeof(str));
+  main_webserver->sendHeader("Cache-Control", "no-store");
+  main_webserver->send(200, "application/json", str);
+}
+
+void WiHomeComm::handleSyncMain()
+{
+  char str[320];
+  sync.format_json(str, sizeof(str));
+  main_webserver->sendHeader("Cache-Control", "no-store");
+  main_webserver->send(200, "application/json", str);
+}
+
+void WiHomeComm::handleUpdateMain()
+{
+  // Starts a pull update, e.g. /update?url=http://192.168.1.10:8000/firmware.bin.gz
+  if (!main_webserver->hasArg("url"))
+  {
+    main_webserver->send(400, "text/plain", "Missing url");
+    return;
+  }
+  String url = main_webserver->arg("url");
+  if (!UpdateAuthorized(main_webserver->arg("token").c_str()))
+  {
+    main_webserver->send(403, "text/plain", ota_password ? "Invalid token" : "Remote updates disabled");
+    return;
+  }
+  if (connect_state != WH_CONNECTED || ota.active())
+  {
+    main_webserver->send(409, "text/plain", "Update not possible now");
+    return;
+  }
+  // Answer before update_from() destroys the web server:
+  pending_update_url = url;
+  main_webserver->send(202, "text/plain", "Update started");
+}
+
+bool WiHomeComm::UpdateAuthorized(const char* token)
+{
+  if (!ota_password || !token)
+    return false;
+  // Compare in constant time, not to give away how much of the token matched:
+  size_t length = strlen(ota_password);
+  byte difference = (strlen(token) != length);
+  size_t m = 0; // Stays on the terminator of a shorter token
+  for (size_t n=0; n<length; n++)
+  {
+    difference |= ota_password[n] ^ token[m];
+    if (token[m])
+      m++;
+  }
+  return (difference == 0 && length > 0);
+}
+
+void WiHomeComm::AssembleValuesJSON(DynamicJsonDocument& doc)
+{
+  doc["client"] = (const char*) client;
   if (main_html)
-    html += (*main_html);
-  html += html_main_form_begin;
-  AddFormItems(html);
-  html += html_main_form_end;
-    main_webserver->send(200, "text/html", html);
+    doc["html"] = main_html->c_str();
+  JsonArray paras = doc.createNestedArray("paras");
+  if (N_config_paras>0)
+    for (int n=0; n<N_config_paras; n++)
+      if (hParas[n]==false)
+      {
+        char str[32];
+        get_config_parameter_string(str, n);
+        JsonObject para = paras.createNestedObject();
+        para["name"] = pNames[n];
+        para["prompt"] = pPrompts[n];
+        para["type"] = (tParas[n]==TYPE_BOOL) ? "bool" : "text";
+        para["value"] = str;
+      }
+}
+
+void WiHomeComm::handleEventsMain()
+{
+  for (int n=0; n<WIHOMECOMM_MAX_EVENT_CLIENTS; n++)
+    if (!event_clients[n].connected())
+    {
+      // Keep a reference to the connection, so it stays open after the request:
+      event_clients[n] = main_webserver->client();
+      event_clients[n].setNoDelay(true);
+      event_clients[n].print("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                             "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n");
+      // Initial status, so the page does not have to wait for the first change:
+      char data[16];
+      sprintf(data, "{\"status\":%d}", status());
+      SendEvent(event_clients[n], "status", data);
+      WHLOG_DEBUG("Event subscriber %d connected.\n", n);
+      return;
+    }
+  main_webserver->send(503, "text/plain", "Too many event subscribers.");
+}
+
+void WiHomeComm::CheckEvents()
+{
+  bool subscribed = false;
+  for (int n=0; n<WIHOMECOMM_MAX_EVENT_CLIENTS; n++)
+    if (event_clients[n].connected())
+      subscribed = true;
+  if (!subscribed)
+  {
+    values_changed = false;
+    return;
+  }
+  byte _status = status();
+  if (_status != event_status)
+  {
+    char data[16];
+    sprintf(data, "{\"status\":%d}", _status);
+    push_event("status", data);
+    event_status = _status;
+  }
+  if (values_changed)
+  {
+    DynamicJsonDocument doc(WIHOMECOMM_VALUES_JSON_SIZE);
+    AssembleValuesJSON(doc);
+    String json;
+    serializeJson(doc, json);
+    push_event("values", json.c_str());
+    values_changed = false;
+  }
+  // Comment line to detect closed connections and to keep proxies from timing out:
+  if (etp_events->enough_time())
+    for (int n=0; n<WIHOMECOMM_MAX_EVENT_CLIENTS; n++)
+      if (event_clients[n].connected())
+        event_clients[n].print(":\n\n");
+}
+
+bool WiHomeComm::SendEvent(WiFiClient& event_client, const char* event, const char* data)
+{
+  if (!event_client.connected())
+    return false;
+  size_t len = strlen(event) + strlen(data) + 16;
+  // Drop subscribers that do not keep up instead of blocking the loop:
+  if (event_client.availableForWrite() < (int) len)
+  {
+    event_client.stop();
+    return false;
+  }
+  event_client.printf("event: %s\ndata: %s\n\n", event, data);
+  return true;
+}
+
+void WiHomeComm::StopEvents()
+{
+  for (int n=0; n<WIHOMECOMM_MAX_EVENT_CLIENTS; n++)
+    if (event_clients[n].connected())
+      event_clients[n].stop();
+}
+
+void WiHomeComm::push_event(const char* event, const char* data)
+{
+  for (int n=0; n<WIHOMECOMM_MAX_EVENT_CLIENTS; n++)
+    SendEvent(event_clients[n], event, data);
+}
+
+void WiHomeComm::push_values()
+{
+  values_changed = true;
 }
 
 void WiHomeComm::handleClientMain()
@@ -543,35 +1319,67 @@ void WiHomeComm::handleClientMain()
   main_webserver->handleClient();
 }
 
+const WiHomeAsset* WiHomeComm::find_asset(const char* uri)
+{
+  for (unsigned int n=0; n<N_wihome_assets; n++)
+    if (strcmp(wihome_assets[n].uri, uri)==0)
+      return &wihome_assets[n];
+  return NULL;
+}
+
+void WiHomeComm::sendAsset(ESP8266WebServer* server, const WiHomeAsset* asset)
+{
+  if (!asset)
+  {
+    server->send(404, "text/plain", "Not found");
+    return;
+  }
+  server->sendHeader("ETag", asset->etag);
+  server->sendHeader("Cache-Control", asset->cache_control);
+  // Browser still has the current version:
+  if (server->header("If-None-Match") == asset->etag)
+  {
+    server->send(304);
+    return;
+  }
+  server->sendHeader("Content-Encoding", "gzip");
+  server->send_P(200, asset->content_type, (PGM_P) asset->data, asset->length);
+}
+
 void WiHomeComm::findhub()
 {
-  if (etp_findhub->enough_time() && wihome_protocol)
+  sync.local_us(); // Keeps track of wraps of the microsecond counter
+  // The heartbeat runs faster until the hub clock is synchronized, but only with a hub
+  // that answers with time stamps and for a limited number of messages:
+  bool sync_request = hub_clock && !sync.synchronized() && N_fast_findhub < WIHOMECOMM_SYNC_FAST_REQUESTS
+                      && clock->ms() - t_sync_request >= WIHOMECOMM_SYNC_FAST_INTERVAL;
+  if ((etp_findhub->enough_time() || sync_request) && wihome_protocol)
   {
-    Serial.printf("\nBroadcast findhub message.\n");
-    IPAddress ip = WiFi.localIP();
-    IPAddress subnetmask = WiFi.subnetMask();
-    IPAddress broadcast_ip(0,0,0,0);
-    for (int n=0; n<4; n++)
-      broadcast_ip[n] = (ip[n] & subnetmask[n]) | ~subnetmask[n];
+    if (sync_request)
+      N_fast_findhub++;
+    WHLOG_DEBUG("\nBroadcast findhub message.\n");
     DynamicJsonDocument doc(1024);
     doc["cmd"]="findhub";
     doc["client"]=client;
-    Udp.beginPacket(broadcast_ip, localUdpPort);
-    serializeJson(doc, Udp);
-    Udp.endPacket();
+    doc["t1"]=sync.request();
+    t_sync_request = clock->ms();
+    network->begin_packet(network->broadcast_ip(), localUdpPort);
+    serializeJson(doc, *network);
+    network->end_packet();
   }
 }
 
 void WiHomeComm::serve_packet(DynamicJsonDocument& doc)
 {
-  int packetSize;
+  int packetSize = 0;
   if (wihome_protocol)
-    packetSize = Udp.parsePacket();
+    packetSize = network->parse_packet();
+  uint64_t t_received = packetSize ? sync.local_us() : 0;
   if (packetSize && wihome_protocol)
   {
     // Serial.printf("\nReceived %d bytes from %s, port %d\n", packetSize,
     //               Udp.remoteIP().toString().c_str(), Udp.remotePort());
-    int len = Udp.read(incomingPacket, 255);
+    int len = network->read(incomingPacket, 254);
     if (len > 0)
       incomingPacket[len] = 0;
     // Serial.printf("UDP packet contents: %s\n", incomingPacket);
@@ -580,7 +1388,7 @@ void WiHomeComm::serve_packet(DynamicJsonDocument& doc)
     // Test if parsing succeeds.
     if (error)
     {
-      Serial.println("deserializeJson() failed");
+      WHLOG_WARN("deserializeJson() failed\n");
     }
     else
     {
@@ -591,18 +1399,38 @@ void WiHomeComm::serve_packet(DynamicJsonDocument& doc)
           if (strcmp(doc["client"],client)==0)
           {
             doc["cmd"] = "clientid";
-            Udp.beginPacket(Udp.remoteIP(), localUdpPort);
-            serializeJson(doc, Udp);
-            Udp.endPacket();
-            hubip = Udp.remoteIP();
+            network->begin_packet(network->remote_ip(), localUdpPort);
+            serializeJson(doc, *network);
+            network->end_packet();
+            hubip = network->remote_ip();
+            if (tracing_discovery)
+              WHTRACE_ASYNC_END("hub_discovery", "findclient");
+            tracing_discovery = false;
             hub_discovered = true;
           }
         }
         if (doc["cmd"]=="hubid")
         {
-          Serial.printf("Found hub: %s\n",Udp.remoteIP().toString().c_str());
-          hubip = Udp.remoteIP();
+          WHLOG_INFO("Found hub: %s\n", network->remote_ip().toString().c_str());
+          hubip = network->remote_ip();
+          if (tracing_discovery)
+            WHTRACE_ASYNC_END("hub_discovery", "hubid");
+          tracing_discovery = false;
           hub_discovered = true;
+          hub_clock = doc.containsKey("t1") && doc.containsKey("t2") && doc.containsKey("t3");
+          if (hub_clock)
+            sync.response(doc["t1"].as<unsigned long long>(), doc["t2"].as<unsigned long long>(),
+                          doc["t3"].as<unsigned long long>(), t_received);
+        }
+        if (doc["cmd"]=="update" && doc.containsKey("url") && hub_discovered
+            && network->remote_ip() == hubip)
+        {
+          // Rolling firmware updates are coordinated by the hub; the source address
+          // is easily spoofed, so the packet has to carry the token as well:
+          if (UpdateAuthorized(doc["token"].as<const char*>()))
+            update_from(doc["url"].as<const char*>());
+          else
+            WHLOG_WARN("Update request from hub rejected (%s).\n", ota_password ? "invalid token" : "disabled");
         }
       }
     }
@@ -611,15 +1439,33 @@ void WiHomeComm::serve_packet(DynamicJsonDocument& doc)
 
 void WiHomeComm::send(DynamicJsonDocument& doc)
 {
-  if (WiFi.status() == WL_CONNECTED && WiFi.getMode() == WIFI_STA && !needMDNS && wihome_protocol)
+  if (network->station_connected() && connect_state == WH_CONNECTED && wihome_protocol)
   {
     doc["client"]=client;
-    Udp.beginPacket(hubip, localUdpPort);
-    serializeJson(doc, Udp);
-    Udp.endPacket();
+    if (stamp_messages)
+    {
+      // Underscore names stay clear of application fields:
+      doc["_seq"]=++tx_seq;
+      if (sync.synchronized())
+        doc["_ts"]=(unsigned long long) sync.hub_us();
+    }
+    network->begin_packet(hubip, localUdpPort);
+    serializeJson(doc, *network);
+    if (network->end_packet() && !traced_send)
+    {
+      WHTRACE_INSTANT("first_send");
+      traced_send = true;
+    }
   }
 }
 
+void WiHomeComm::reconnect()
+{
+  if (live_config)
+    StopLiveConfig();
+  connect_state = WH_INIT;
+}
+
 bool WiHomeComm::is_homekit_reset()
 {
   bool _homekit_reset = homekit_reset;
@@ -630,6 +1476,7 @@ bool WiHomeComm::is_homekit_reset()
 
 void WiHomeComm::LoadUserData()
 {
+  WHTRACE_BEGIN("LoadUserData");
   // config->get("homekit_reset", &homekit_reset);
   if (N_config_paras>0)
       for (int n=0; n<N_config_paras; n++)
@@ -647,7 +1494,22 @@ void WiHomeComm::LoadUserData()
             break;
         }
       }
-  config->dump();
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_DEBUG
+  for (int n=0; n<N_config_paras; n++)
+    LogParameter(n);
+#endif
+  WHTRACE_END("LoadUserData");
+}
+
+void WiHomeComm::LogParameter(int n)
+{
+  // Deferred like all log output, with the WiFi password redacted:
+  char str[32];
+  get_config_parameter_string(str, n);
+  if (pParas[n] == password)
+    WHLOG_DEBUG("Para %s: %s\n", pNames[n], WHLOG_SECRET(str));
+  else
+    WHLOG_DEBUG("Para %s: %s\n", pNames[n], str);
 }
 
 void WiHomeComm::SaveUserData()
@@ -656,10 +1518,9 @@ void WiHomeComm::SaveUserData()
     if (N_config_paras>0)
       for (int n=0; n<N_config_paras; n++)
       {
-        char str[32];
-        Serial.print("Para: ");
-        get_config_parameter_string(str, n);
-        Serial.println(str);
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_DEBUG
+        LogParameter(n);
+#endif
         switch(tParas[n])
         {
           case TYPE_CSTR:
@@ -673,12 +1534,13 @@ void WiHomeComm::SaveUserData()
             break;
         }
       }
-  config->set("dummy", 0);
-  config->dump();
+  config->write();
+  InvalidateConfigPage();
 }
 
 void WiHomeComm::add_config_parameter(void* pPara, const char* pName, const char* pPrompt, datatypes tPara)
 {
+  WHTRACE_BEGIN("add_config_parameter", pName);
   pParas[N_config_paras] = pPara;
   pPrompts[N_config_paras] = pPrompt;
   tParas[N_config_paras] = tPara;
@@ -686,6 +1548,8 @@ void WiHomeComm::add_config_parameter(void* pPara, const char* pName, const char
   hParas[N_config_paras] = false;
   N_config_paras++;
   LoadUserData();
+  InvalidateConfigPage();
+  WHTRACE_END("add_config_parameter", pName);
 }
 
 void WiHomeComm::add_config_parameter(char* pPara, const char* pName, const char* pPrompt)
@@ -705,6 +1569,8 @@ void WiHomeComm::add_config_parameter(bool* pPara, const char* pName, const char
 
 void WiHomeComm::update_config_parameter(int n, const char* value)
 {
+  InvalidateConfigPage();
+  values_changed = true;
   switch (tParas[n])
   {
     case TYPE_CSTR:
@@ -8,12 +8,21 @@
 #include <ArduinoOTA.h>
 #include <pgmspace.h>
 #include "Arduino.h"
-#include "EnoughTimePassed.h"
 #include <ArduinoJson.h>
 #include "ConfigFileJSON.h"
 #include "SignalLED.h"
 #include "NoBounceButtons.h"
 #include "RGBstrip.h"
+#include "WiHomeAssets.h"
+#include "WiHomeLog.h"
+#include "WiHomeTrace.h"
+#include "WiHomeNetwork.h"
+#include "WiHomeStorage.h"
+#include "WiHomeClock.h"
+#include "WiHomeHeap.h"
+#include "WiHomeOTA.h"
+#include "WiHomeSync.h"
+#include "WiHomeScan.h"
 
 #ifndef WIHOMECOMM_H
 #define WIHOMECOMM_H
@@ -22,6 +31,22 @@
 #define WIHOMECOMM_WAITFOR_CONNECT_INTERVAL 250
 #define WIHOMECOMM_MAX_CONNECT_COUNT 0
 #define WIHOMECOMM_FINDHUB_INTERVAL 60000 //ms
+#define WIHOMECOMM_SYNC_FAST_INTERVAL 2000 //ms, findhub interval until the hub clock is synchronized
+#define WIHOMECOMM_SYNC_FAST_REQUESTS 10 // Fast findhub messages per connection at most
+#define WIHOMECOMM_DNS_MAX_REQUESTS 8 // DNS requests drained per check() in SoftAP mode
+#define WIHOMECOMM_HTTP_MAX_CLIENTS 2 // HTTP clients served per check() in SoftAP mode
+#define WIHOMECOMM_VALUES_JSON_SIZE 2048 // Capacity of the /values.json document
+#define WIHOMECOMM_RX_JSON_SIZE 128 // Capacity of the receive document reused by check()
+#define WIHOMECOMM_MAX_EVENT_CLIENTS 4 // Concurrent subscribers of the /events stream
+#define WIHOMECOMM_EVENT_KEEPALIVE_INTERVAL 15000 //ms
+#define WIHOMECOMM_RSSI_INTERVAL 5000 //ms, link quality sampling interval
+#define WIHOMECOMM_RSSI_EWMA_ALPHA 0.2 // Weight of a new RSSI sample in the moving average
+#define WIHOMECOMM_RSSI_HISTORY 24 // Number of RSSI samples kept for /link.json
+#define WIHOMECOMM_ROAM_THRESHOLD -75 //dBm, averaged RSSI below which roaming candidates are scanned for
+#define WIHOMECOMM_ROAM_HYSTERESIS 8 //dB, a candidate must be this much stronger than the current link
+#define WIHOMECOMM_ROAM_SCAN_INTERVAL 60000 //ms, minimum time between roaming scans
+#define WIHOMECOMM_ROAM_TIMEOUT 10000 //ms, fall back to a full reconnect after this
+#define WIHOMECOMM_ERROR_RETRY 5000 //ms, pause before a failed connection sequence starts over
 
 #define WIHOMECOMM_UNKNOWN 0
 #define WIHOMECOMM_CONNECTED 1
@@ -29,12 +54,18 @@
 #define WIHOMECOMM_DISCONNECTED 3
 #define WIHOMECOMM_SOFTAP 4
 
-const char html_config_form_begin[] = {"<!DOCTYPE html><html><head><meta name='viewport' content='width=device-width'></head><body><h2 style='font-family:verdana;'>WiHome Setup</h2><form action='/save_and_restart.php' style='font-family:verdana;'>"};
+const char html_config_form_begin[] = {"<!DOCTYPE html><html><head><meta name='viewport' content='width=device-width'><link rel='stylesheet' href='/style.css'></head><body><h2>WiHome Setup</h2><form action='/save_and_restart.php'>"};
 const char html_config_form_end[] = {"<br>  <input type='submit' value='Save and Connect'></form> </body></html>"};
 
-const char html_main_begin[] = {"<!DOCTYPE html><html><head><meta name='viewport' content='width=device-width'></head><body style='font-family:verdana;'><h2 style='font-family:verdana;'>WiHome HKfan</h2>"};
-const char html_main_form_begin[] = {"<form action='/' style='font-family:verdana;'>"};
-const char html_main_form_end[] = {"<br><br><input type='submit' name='submit' value='save'><input type='submit' name='submit' value='reload'></form> </body></html>"};
+// Connectivity probe URLs of common operating systems; in SoftAP mode these are
+// answered with a precomputed redirect instead of rendering the config form:
+const char* const captive_probe_uris[] = {"/generate_204", "/gen_204", "/hotspot-detect.html",
+  "/library/test/success.html", "/connecttest.txt", "/ncsi.txt", "/redirect", "/success.txt",
+  "/canonical.html", "/chat", "/fwlink"};
+const char captive_portal_url[] = {"http://192.168.4.1/"};
+const char html_captive_redirect[] = {"<!DOCTYPE html><html><head><meta http-equiv='refresh' content='0; url=http://192.168.4.1/'></head></html>"};
+
+// The main page is the static shell data/index.html, filled in by data/main.js from /values.json.
 
 class WiHomeComm
 {
@@ -45,26 +76,71 @@ class WiHomeComm
     char password[32];
     char client[32];
     bool homekit_reset = false;
-    // ConfigFileJSON:
-    ConfigFileJSON* config;
+    // Network, persistent storage and time source (ESP8266 defaults or injected):
+    WiHomeNetwork* network;
+    WiHomeStorage* config;
+    WiHomeClock* clock;
     // SoftAP configuration
     char ssid_softAP[32];
-    ESP8266WebServer* config_webserver = NULL;
-    ESP8266WebServer* main_webserver = NULL;
+    // Statically reserved storage for the web and DNS server, constructed on first use
+    // and kept across mode changes, to avoid heap fragmentation:
+    alignas(ESP8266WebServer) unsigned char webserver_storage[sizeof(ESP8266WebServer)];
+    alignas(DNSServer) unsigned char dnsserver_storage[sizeof(DNSServer)];
+    alignas(WiHomeTimer) unsigned char etp_findhub_storage[sizeof(WiHomeTimer)];
+    DynamicJsonDocument rx_doc{WIHOMECOMM_RX_JSON_SIZE}; // Receive document of check()
+    ESP8266WebServer* webserver = NULL;
+    ESP8266WebServer* config_webserver = NULL; // webserver while the config portal runs
+    String* config_html = NULL; // Cached config page, rendered on first request
+    bool live_config = false; // Config portal runs in AP+STA mode next to the station connection
+    bool softap_up = false; // Soft AP of the config portal (without station) is set up
+    ESP8266WebServer* main_webserver = NULL; // webserver in station mode
+    // Server-sent events (/events) on the main web server:
+    WiFiClient event_clients[WIHOMECOMM_MAX_EVENT_CLIENTS];
+    WiHomeTimer* etp_events = NULL;
+    byte event_status = WIHOMECOMM_UNKNOWN;
+    bool values_changed = false;
     DNSServer* dnsServer = NULL;
     const byte DNS_PORT = 53;
     // WiHome UDP communication configuration
-    WiFiUDP Udp;
     unsigned int localUdpPort = 24557; //24559;
     char incomingPacket[255];
     IPAddress hubip;
-    EnoughTimePassed* etp_findhub = NULL;
+    WiHomeTimer* etp_findhub = NULL;
     bool hub_discovered = false;
     bool wihome_protocol = true;
     bool connect_wifi = true;
     // Settings for WiFi persistence
-    EnoughTimePassed* etp_Wifi = NULL;
-    bool needMDNS = true;
+    WiHomeTimer* etp_Wifi = NULL;
+    bool traced_send = false; // First successful send() is marked in the trace
+    const char* trace_span = NULL; // Open connect_station or roam trace span
+    bool tracing_discovery = false; // Open hub_discovery trace span
+    // Link quality monitoring and roaming between access points of the same SSID:
+    WiHomeTimer* etp_rssi = NULL;
+    WiHomeTimer* etp_roam_scan = NULL;
+    float rssi_ewma = 0;
+    int8_t rssi_history[WIHOMECOMM_RSSI_HISTORY];
+    unsigned long N_rssi_samples = 0; // Total number of samples, also ring index of rssi_history
+    bool rssi_valid = false; // rssi_ewma holds at least one sample of the current access point
+    bool roam_scanning = false;
+    uint8_t roam_bssid[6];
+    int32_t roam_channel = 0;
+    IPAddress roam_ip;
+    unsigned long roam_start = 0;
+    unsigned long error_start = 0; // Time the connection sequence failed (WH_ERROR)
+    unsigned long N_roams = 0;
+    unsigned long N_roam_failures = 0;
+    unsigned long N_roam_scans = 0;
+    // Firmware updates (UDP, discovery and the web server pause while one is in flight):
+    WiHomeOTA ota;
+    String pending_update_url; // Requested on /update, started after the request is answered
+    // Hub clock synchronization over findhub/hubid and message stamping in send():
+    WiHomeSync sync;
+    unsigned long t_sync_request = 0;
+    bool hub_clock = false; // The hub answered hubid with time stamps
+    unsigned int N_fast_findhub = 0;
+    uint32_t tx_seq = 0;
+    // Access point scan for the network picker of the config portal:
+    WiHomeScan network_scan;
     enum WIHOME_STATES
     {
       WH_INIT,        // 0
@@ -79,6 +155,9 @@ class WiHomeComm
       WH_START_UDP,   // 9
       WH_CONNECTED,   // 10
       WH_NO_WIFI,     // 11
+      WH_ROAM,        // 12
+      WH_WAITFOR_ROAM,// 13
+      WH_UPDATE,      // 14
       WH_ERROR = 255,
     };
     enum WIHOME_STATES connect_state = WH_INIT;
@@ -96,27 +175,61 @@ class WiHomeComm
     // Methods:
     bool ConnectStation();
     void ConnectSoftAP();
+    void CheckLink();
+    void CheckRoamScan();
+    void EnterErrorState();
+    void StopUdp();
+    void PauseForUpdate();
+    bool ConnectLiveConfig();
+    void StopLiveConfig();
     void LoadUserData();
     void SaveUserData();
+    void LogParameter(int n);
     // Methods for common code between Config and Main web server:
     void AddFormItems(String &html, bool show_secure=false);
     // Config web server for SoftAP mode:
+    void CreateWebServer(int port);
+    void OnMode(const char* uri, bool config_mode, void (WiHomeComm::*handler)());
+    void handleRoot();
+    void handleAsset(const WiHomeAsset* asset);
     void CreateConfigWebServer(int port);
     void DestroyConfigWebServer();
     void handleRootConfig();
+    void handleCaptiveProbe();
+    void InvalidateConfigPage();
     void handleNotFoundConfig();
     void handleSaveAndRestartConfig();
     void handleClientConfig();
+    void handleNetworksConfig();
+    void CheckNetworkScan();
     // Main web server for regular Wifi connection:
     void CreateMainWebServer(int port);
     void DestroyMainWebServer();
     void handleRootMain();
     void handleSaveMain();
     void handleClientMain();
+    void handleValuesMain();
+    void handleTraceMain();
+    void handleHeapMain();
+    void handleLinkMain();
+    void handleOTAMain();
+    void handleSyncMain();
+    void handleUpdateMain();
+    bool UpdateAuthorized(const char* token);
+    void AssembleValuesJSON(DynamicJsonDocument& doc);
+    // Server-sent events for the main web server:
+    void handleEventsMain();
+    void CheckEvents();
+    bool SendEvent(WiFiClient& event_client, const char* event, const char* data);
+    void StopEvents();
+    // Static gzip compressed assets (see WiHomeAssets.h):
+    const WiHomeAsset* find_asset(const char* uri);
+    void sendAsset(ESP8266WebServer* server, const WiHomeAsset* asset);
     // WiHome communication methods:
     void findhub();
     void serve_packet(DynamicJsonDocument& doc);
-    void init(bool _wihome_protocol, bool _connect_wifi);
+    void init(WiHomeNetwork* _network, WiHomeStorage* _storage, WiHomeClock* _clock,
+              bool _wihome_protocol, bool _connect_wifi);
     void check_status_led();
     void check_button();
     // Template functions to assemble JSON object from variable number of input parameters:
@@ -155,6 +268,10 @@ class WiHomeComm
     WiHomeComm();
     WiHomeComm(bool _wihome_protocol);  // Optional argument to deactivate wihome UDP communication protocol
     WiHomeComm(bool _wihome_protocol, bool _connect_wifi); // Optional argument to not connect to a Wifi AP
+    // Injected network, storage and clock, e.g. for many instances in one host process:
+    WiHomeComm(WiHomeNetwork* _network, WiHomeStorage* _storage, WiHomeClock* _clock);
+    WiHomeComm(WiHomeNetwork* _network, WiHomeStorage* _storage, WiHomeClock* _clock,
+               bool _wihome_protocol, bool _connect_wifi);
     void set_status_led(SignalLED* _status_led);
     void set_status_led(SignalLED* _status_led, unsigned int* _led_status);
     void set_status_led(SignalLED* _status_led, SignalLED* _relay);
@@ -166,7 +283,32 @@ class WiHomeComm
     void check();
     void check(DynamicJsonDocument& doc);
     void send(DynamicJsonDocument& doc);
+    void reconnect(); // Restart the station connection
+    // Link quality (averaged RSSI in dBm, 0 if unknown) and roaming statistics:
+    int get_rssi();
+    unsigned int get_rssi_history(int* target, unsigned int size); // Oldest first, returns count
+    unsigned long get_roam_count();
+    unsigned long get_roam_failures();
+    bool allow_roaming = true; // Switch to a stronger access point of the same SSID
+    // Firmware update pulled from http://host[:port]/path (plain or gzip compressed image):
+    bool update_from(const char* url);
+    // Password of ArduinoOTA pushes, also required as "token" by /update and hub update
+    // packets; remote pulls are disabled while it is NULL:
+    const char* ota_password = NULL;
+    bool update_in_progress();
+    unsigned int get_update_progress(); // %
+    unsigned long get_update_throughput(); // Bytes/s
+    // Hub clock (from the findhub/hubid heartbeat) and latency estimates, times in us:
+    bool stamp_messages = false; // Add "_seq" and, once synchronized, hub time "_ts" to send()
+    bool is_clock_synchronized();
+    uint64_t get_hub_time(); // us, 0 if not synchronized
+    int64_t get_clock_offset(); // Hub minus local clock
+    double get_clock_drift(); // ppm
+    uint32_t get_round_trip();
+    int32_t get_uplink_latency(); // Device to hub
+    int32_t get_downlink_latency(); // Hub to device
     bool softAPmode = false;
+    bool allow_live_config = true; // Keep the station connected while the config portal runs
     bool is_homekit_reset();
     // Template functions to write s variable number of input parameters as JSON object:
     template<typename... Args>
@@ -188,6 +330,20 @@ class WiHomeComm
     // Methods to handle external html content for main web page:
     void attach_html(String* _main_html);
     void detach_html();
+    // Methods to push live updates to the main web page (/events):
+    void push_event(const char* event, const char* data);
+    void push_values(); // Config parameters were changed by the application
+    // Template function to push a variable number of application fields as "app" event;
+    // the main page writes each value into the element with the same id:
+    template<typename... Args>
+    void pushJSON(Args... args)
+    {
+        DynamicJsonDocument doc(1024);
+        assembleJSON(doc, args...);
+        String json;
+        serializeJson(doc, json);
+        push_event("app", json.c_str());
+    }
 };
 
 #endif // WIHOMECOMM_H
@@ -0,0 +1,98 @@
+// Class for heap accounting per subsystem
+// for WiHome devices
+
+#include "WiHomeHeap.h"
+
+WiHomeHeap wihome_heap;
+
+static const char* const heap_subsystem_names[WH_HEAP_N_SUBSYSTEMS] = {"web", "dns", "config_page", "udp"};
+
+void WiHomeHeap::set_readers(WiHomeHeapReader free_heap, WiHomeHeapReader max_block)
+{
+  read_free_heap = free_heap;
+  read_max_block = max_block;
+}
+
+void WiHomeHeap::begin(byte subsystem)
+{
+  mark[subsystem] = free_heap();
+}
+
+void WiHomeHeap::end(byte subsystem)
+{
+  // Positive for allocations, negative for deallocations:
+  long delta = (long) mark[subsystem] - (long) free_heap();
+  current_bytes[subsystem] += delta;
+  if (current_bytes[subsystem] > peak_bytes[subsystem])
+    peak_bytes[subsystem] = current_bytes[subsystem];
+  uint32_t block = max_free_block();
+  if (delta > 0 && (min_block[subsystem] == 0 || block < min_block[subsystem]))
+    min_block[subsystem] = block;
+  sample();
+}
+
+void WiHomeHeap::sample()
+{
+  uint32_t heap = free_heap();
+  uint32_t block = max_free_block();
+  if (heap < min_free_heap)
+    min_free_heap = heap;
+  if (block < min_max_block)
+    min_max_block = block;
+}
+
+long WiHomeHeap::current(byte subsystem)
+{
+  return current_bytes[subsystem];
+}
+
+long WiHomeHeap::peak(byte subsystem)
+{
+  return peak_bytes[subsystem];
+}
+
+uint32_t WiHomeHeap::largest_free_block(byte subsystem)
+{
+  return min_block[subsystem];
+}
+
+uint32_t WiHomeHeap::free_heap()
+{
+  return read_free_heap ? read_free_heap() : ESP.getFreeHeap();
+}
+
+uint32_t WiHomeHeap::lowest_free_heap()
+{
+  return min_free_heap;
+}
+
+uint32_t WiHomeHeap::max_free_block()
+{
+  return read_max_block ? read_max_block() : ESP.getMaxFreeBlockSize();
+}
+
+uint32_t WiHomeHeap::lowest_max_free_block()
+{
+  return min_max_block;
+}
+
+const char* WiHomeHeap::name(byte subsystem)
+{
+  return heap_subsystem_names[subsystem];
+}
+
+size_t WiHomeHeap::format_json(char* str, size_t size)
+{
+  sample();
+  int length = snprintf(str, size, "{\"free\":%lu,\"lowest_free\":%lu,\"max_block\":%lu,\"lowest_max_block\":%lu",
+                        (unsigned long) free_heap(), (unsigned long) min_free_heap,
+                        (unsigned long) max_free_block(), (unsigned long) min_max_block);
+  for (byte n=0; n<WH_HEAP_N_SUBSYSTEMS && length > 0 && (size_t) length < size; n++)
+    length += snprintf(&str[length], size - length, ",\"%s\":{\"current\":%ld,\"peak\":%ld,\"max_block\":%lu}",
+                       heap_subsystem_names[n], current_bytes[n], peak_bytes[n], (unsigned long) min_block[n]);
+  if (length > 0 && (size_t) length < size)
+    length += snprintf(&str[length], size - length, "}");
+  if (length < 0)
+    return 0;
+  return ((size_t) length < size) ? length : size - 1;
+}
@@ -0,0 +1,53 @@
+// WiHome Heap Accounting Class
+//
+// Attributes heap usage to subsystems by measuring the free heap around their
+// allocations and deallocations (begin()/end()), and keeps the minimum free heap
+// and the smallest largest-free-block seen, as indicator for fragmentation. The
+// numbers come from ESP.getFreeHeap()/getMaxFreeBlockSize() unless other readers
+// are set (e.g. the allocator statistics of a host backend).
+#include "Arduino.h"
+
+#ifndef WIHOMEHEAP_H
+#define WIHOMEHEAP_H
+
+enum WIHOME_HEAP_SUBSYSTEMS
+{
+  WH_HEAP_WEB,         // 0: main and config web server
+  WH_HEAP_DNS,         // 1: captive portal DNS server
+  WH_HEAP_CONFIG_PAGE, // 2: cached config page
+  WH_HEAP_UDP,         // 3: UDP services
+  WH_HEAP_N_SUBSYSTEMS
+};
+
+typedef uint32_t (*WiHomeHeapReader)();
+
+class WiHomeHeap
+{
+  private:
+    WiHomeHeapReader read_free_heap = NULL;
+    WiHomeHeapReader read_max_block = NULL;
+    uint32_t mark[WH_HEAP_N_SUBSYSTEMS];
+    long current_bytes[WH_HEAP_N_SUBSYSTEMS];
+    long peak_bytes[WH_HEAP_N_SUBSYSTEMS];
+    uint32_t min_block[WH_HEAP_N_SUBSYSTEMS]; // Largest free block after allocations, minimum
+    uint32_t min_free_heap = 0xffffffff;
+    uint32_t min_max_block = 0xffffffff;
+  public:
+    void set_readers(WiHomeHeapReader free_heap, WiHomeHeapReader max_block);
+    void begin(byte subsystem);
+    void end(byte subsystem);
+    void sample(); // Update minimum free heap and largest free block
+    long current(byte subsystem);
+    long peak(byte subsystem);
+    uint32_t largest_free_block(byte subsystem);
+    uint32_t free_heap();
+    uint32_t lowest_free_heap();
+    uint32_t max_free_block();
+    uint32_t lowest_max_free_block();
+    const char* name(byte subsystem);
+    size_t format_json(char* str, size_t size);
+};
+
+extern WiHomeHeap wihome_heap;
+
+#endif // WIHOMEHEAP_H
@@ -0,0 +1,232 @@
+// Class for deferred, non-blocking logging
+// for WiHome devices
+
+#include "WiHomeLog.h"
+#include <ESP8266WiFi.h>
+
+WiHomeLog wihome_log;
+
+WiHomeLog::entry* WiHomeLog::reserve(byte level, const char* format)
+{
+  n_logged++;
+  if (count == WIHOMELOG_BUFFER_SIZE)
+  {
+    n_dropped++;
+    return NULL;
+  }
+  entry* e = &entries[head];
+  head = (head + 1) % WIHOMELOG_BUFFER_SIZE;
+  count++;
+  e->format = format;
+  e->level = level;
+  e->n_args = 0;
+  e->text_length = 0;
+  e->sent = 0;
+  return e;
+}
+
+void WiHomeLog::add_arg(entry* e, byte type, long i, unsigned long u, double f)
+{
+  if (e->n_args == WIHOMELOG_MAX_ARGS)
+    return;
+  e->types[e->n_args] = type;
+  if (type == ARG_INT)
+    e->values[e->n_args].i = i;
+  else if (type == ARG_UINT)
+    e->values[e->n_args].u = u;
+  else
+    e->values[e->n_args].f = f;
+  e->n_args++;
+}
+
+void WiHomeLog::add_arg(entry* e, const char* str, byte type)
+{
+  if (e->n_args == WIHOMELOG_MAX_ARGS)
+    return;
+  // Strings are copied, since the pointer may not be valid anymore when draining:
+  e->types[e->n_args] = type;
+  int space = WIHOMELOG_TEXT_SIZE - (int) e->text_length;
+  if (space <= 1)
+  {
+    // No room left: text ends with the terminator of the previous argument,
+    // which serves as an empty string
+    e->values[e->n_args].u = e->text_length - 1;
+    e->n_args++;
+    return;
+  }
+  e->values[e->n_args].u = e->text_length;
+  if (type == ARG_STR && str)
+  {
+    size_t length = strlen(str);
+    if (length > (size_t) (space - 1))
+      length = space - 1;
+    memcpy(&e->text[e->text_length], str, length);
+    e->text_length += length;
+  }
+  e->text[e->text_length++] = 0;
+  e->n_args++;
+}
+
+size_t WiHomeLog::format_entry(entry* e, char* line, size_t size)
+{
+  size_t length = 0;
+  byte n_arg = 0;
+  const char* p = e->format;
+  while (*p && length < size - 1)
+  {
+    if (*p != '%')
+    {
+      line[length++] = *p++;
+      continue;
+    }
+    if (p[1] == '%')
+    {
+      line[length++] = '%';
+      p += 2;
+      continue;
+    }
+    // Copy flags, width and precision, drop length modifiers:
+    char spec[16];
+    byte n = 0;
+    spec[n++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 3)
+      spec[n++] = *p++;
+    while (*p && strchr("hlzjt", *p))
+      p++;
+    char conversion = *p;
+    if (conversion)
+      p++;
+    int written = 0;
+    char* out = &line[length];
+    size_t left = size - length;
+    if (n_arg >= e->n_args || !strchr("diouxXcsfFeEgG", conversion))
+      written = snprintf(out, left, "%s", "?");
+    else if (e->types[n_arg] == ARG_SECRET)
+      written = snprintf(out, left, "%s", "***");
+    else if (conversion == 's')
+    {
+      spec[n++] = 's';
+      spec[n] = 0;
+      const char* str = (e->types[n_arg] == ARG_STR) ? &e->text[e->values[n_arg].u] : "?";
+      written = snprintf(out, left, spec, str);
+    }
+    else if (strchr("fFeEgG", conversion))
+    {
+      spec[n++] = conversion;
+      spec[n] = 0;
+      double value = e->values[n_arg].f;
+      if (e->types[n_arg] == ARG_INT)
+        value = e->values[n_arg].i;
+      else if (e->types[n_arg] == ARG_UINT)
+        value = e->values[n_arg].u;
+      written = snprintf(out, left, spec, value);
+    }
+    else
+    {
+      spec[n++] = 'l';
+      spec[n++] = conversion;
+      spec[n] = 0;
+      long value = e->values[n_arg].i;
+      if (e->types[n_arg] == ARG_DOUBLE)
+        value = (long) e->values[n_arg].f;
+      if (strchr("di", conversion))
+        written = snprintf(out, left, spec, value);
+      else if (conversion == 'c')
+        written = snprintf(out, left, "%c", (char) value);
+      else
+        written = snprintf(out, left, spec, (unsigned long) value);
+    }
+    n_arg++;
+    if (written > 0)
+      length += ((size_t) written < left) ? written : left - 1;
+  }
+  line[length] = 0;
+  return length;
+}
+
+void WiHomeLog::write_syslog(const char* line, size_t length, byte level)
+{
+  if (syslog_udp && WiFi.isConnected())
+  {
+    // RFC 3164 message, facility local0, severity from log level:
+    const byte severity[] = {7, 3, 4, 6, 7};
+    char header[24];
+    snprintf(header, sizeof(header), "<%d>wihome: ", 128 + severity[level]);
+    while (length > 0 && (line[0] == '\n'))
+    {
+      line++;
+      length--;
+    }
+    while (length > 0 && line[length-1] == '\n')
+      length--;
+    if (length == 0)
+      return;
+    syslog_udp->beginPacket(IPAddress(syslog_ip), syslog_port);
+    syslog_udp->write((const uint8_t*) header, strlen(header));
+    syslog_udp->write((const uint8_t*) line, length);
+    syslog_udp->endPacket();
+  }
+}
+
+void WiHomeLog::drain()
+{
+  char line[WIHOMELOG_LINE_SIZE];
+  while (count > 0)
+  {
+    entry* e = &entries[tail];
+    size_t length = format_entry(e, line, sizeof(line));
+    // Write as much as the Serial transmit buffer takes; it may be smaller than
+    // a line (128 byte FIFO on the ESP8266), the rest follows on the next call:
+    int room = Serial.availableForWrite();
+    if (room <= 0)
+      return;
+    size_t piece = length - e->sent;
+    if (piece > (size_t) room)
+      piece = room;
+    Serial.write((const uint8_t*) &line[e->sent], piece);
+    e->sent += piece;
+    if (e->sent < length)
+      return;
+    write_syslog(line, length, e->level);
+    tail = (tail + 1) % WIHOMELOG_BUFFER_SIZE;
+    count--;
+  }
+}
+
+void WiHomeLog::flush()
+{
+  char line[WIHOMELOG_LINE_SIZE];
+  while (count > 0)
+  {
+    entry* e = &entries[tail];
+    size_t length = format_entry(e, line, sizeof(line));
+    Serial.write((const uint8_t*) &line[e->sent], length - e->sent);
+    write_syslog(line, length, e->level);
+    tail = (tail + 1) % WIHOMELOG_BUFFER_SIZE;
+    count--;
+  }
+  Serial.flush();
+}
+
+void WiHomeLog::set_syslog(IPAddress ip, unsigned int port)
+{
+  if (!syslog_udp)
+    syslog_udp = new WiFiUDP();
+  syslog_ip = (uint32_t) ip;
+  syslog_port = port;
+}
+
+unsigned long WiHomeLog::logged()
+{
+  return n_logged;
+}
+
+unsigned long WiHomeLog::dropped()
+{
+  return n_dropped;
+}
+
+unsigned int WiHomeLog::pending()
+{
+  return count;
+}
@@ -0,0 +1,134 @@
+// WiHome Logging Class
+//
+// Log messages are stored as format pointer plus arguments in a ring buffer and
+// only formatted and written out by drain() as far as there is room in the Serial
+// transmit buffer, so logging never blocks the loop. Levels above
+// WIHOMECOMM_LOG_LEVEL are removed at compile time.
+#include <WiFiUdp.h>
+#include "Arduino.h"
+
+#ifndef WIHOMELOG_H
+#define WIHOMELOG_H
+
+#define WHLOG_LEVEL_NONE 0
+#define WHLOG_LEVEL_ERROR 1
+#define WHLOG_LEVEL_WARN 2
+#define WHLOG_LEVEL_INFO 3
+#define WHLOG_LEVEL_DEBUG 4
+
+#ifndef WIHOMECOMM_LOG_LEVEL
+#define WIHOMECOMM_LOG_LEVEL WHLOG_LEVEL_INFO
+#endif
+#ifndef WIHOMELOG_BUFFER_SIZE
+#define WIHOMELOG_BUFFER_SIZE 16 // Number of buffered log messages
+#endif
+#define WIHOMELOG_MAX_ARGS 4 // Maximum number of arguments per message
+#define WIHOMELOG_TEXT_SIZE 48 // Storage for copies of string arguments per message
+#define WIHOMELOG_LINE_SIZE 160 // Maximum length of a formatted message
+#define WIHOMELOG_SYSLOG_PORT 514
+
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_ERROR
+#define WHLOG_ERROR(...) wihome_log.log(WHLOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define WHLOG_ERROR(...) do {} while (0)
+#endif
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_WARN
+#define WHLOG_WARN(...) wihome_log.log(WHLOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define WHLOG_WARN(...) do {} while (0)
+#endif
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_INFO
+#define WHLOG_INFO(...) wihome_log.log(WHLOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define WHLOG_INFO(...) do {} while (0)
+#endif
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_DEBUG
+#define WHLOG_DEBUG(...) wihome_log.log(WHLOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define WHLOG_DEBUG(...) do {} while (0)
+#endif
+// Marks an argument as secret, it is written out as "***":
+#define WHLOG_SECRET(x) WiHomeLogSecret(x)
+
+struct WiHomeLogSecret
+{
+  explicit WiHomeLogSecret(const char* _value) : value(_value) {}
+  const char* value;
+};
+
+class WiHomeLog
+{
+  private:
+    enum argtypes
+    {
+      ARG_INT,
+      ARG_UINT,
+      ARG_DOUBLE,
+      ARG_STR,
+      ARG_SECRET,
+    };
+    struct entry
+    {
+      const char* format;
+      byte level;
+      byte n_args;
+      byte text_length;
+      byte sent; // Characters of the formatted line already written to Serial
+      byte types[WIHOMELOG_MAX_ARGS];
+      union
+      {
+        long i;
+        unsigned long u;
+        double f;
+      } values[WIHOMELOG_MAX_ARGS];
+      char text[WIHOMELOG_TEXT_SIZE];
+    };
+    entry entries[WIHOMELOG_BUFFER_SIZE];
+    unsigned int head = 0; // Next entry to write
+    unsigned int tail = 0; // Next entry to drain
+    unsigned int count = 0;
+    unsigned long n_logged = 0;
+    unsigned long n_dropped = 0;
+    // Optional syslog sink:
+    WiFiUDP* syslog_udp = NULL;
+    uint32_t syslog_ip = 0; // Plain address keeps wihome_log constant-initialized
+    unsigned int syslog_port = WIHOMELOG_SYSLOG_PORT;
+    entry* reserve(byte level, const char* format);
+    void add_arg(entry* e, byte type, long i, unsigned long u, double f);
+    void add_arg(entry* e, const char* str, byte type);
+    void add_args(entry*) {}
+    template<typename T, typename... Args>
+    void add_args(entry* e, T arg, Args... args)
+    {
+      add_arg(e, arg);
+      add_args(e, args...);
+    }
+    void add_arg(entry* e, int value) { add_arg(e, ARG_INT, value, 0, 0); }
+    void add_arg(entry* e, long value) { add_arg(e, ARG_INT, value, 0, 0); }
+    void add_arg(entry* e, unsigned int value) { add_arg(e, ARG_UINT, 0, value, 0); }
+    void add_arg(entry* e, unsigned long value) { add_arg(e, ARG_UINT, 0, value, 0); }
+    void add_arg(entry* e, double value) { add_arg(e, ARG_DOUBLE, 0, 0, value); }
+    void add_arg(entry* e, const char* value) { add_arg(e, value, ARG_STR); }
+    void add_arg(entry* e, const String& value) { add_arg(e, value.c_str(), ARG_STR); }
+    void add_arg(entry* e, WiHomeLogSecret value) { add_arg(e, value.value, ARG_SECRET); }
+    size_t format_entry(entry* e, char* line, size_t size);
+    void write_syslog(const char* line, size_t length, byte level);
+  public:
+    template<typename... Args>
+    void log(byte level, const char* format, Args... args)
+    {
+      entry* e = reserve(level, format);
+      if (e)
+        add_args(e, args...);
+    }
+    void drain(); // Write out as many messages as fit without blocking
+    void flush(); // Write out all messages, blocking
+    void set_syslog(IPAddress ip, unsigned int port=WIHOMELOG_SYSLOG_PORT);
+    unsigned long logged();
+    unsigned long dropped();
+    unsigned int pending();
+};
+
+extern WiHomeLog wihome_log;
+
+#endif // WIHOMELOG_H
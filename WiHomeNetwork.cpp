@@ -0,0 +1,273 @@
+// ESP8266 implementation of the network interface
+// for WiHome devices
+
+#include "WiHomeNetwork.h"
+#include "WiHomeOTA.h"
+#include <Updater.h>
+
+bool WiHomeNetworkESP::station_mode()
+{
+  return (WiFi.getMode() == WIFI_STA);
+}
+
+bool WiHomeNetworkESP::softap_mode()
+{
+  // A background scan of the config portal adds the station interface (AP+STA):
+  return (WiFi.getMode() & WIFI_AP);
+}
+
+bool WiHomeNetworkESP::stop_softap()
+{
+  if (WiFi.getMode() & WIFI_AP)
+    return WiFi.softAPdisconnect(true);
+  return true;
+}
+
+bool WiHomeNetworkESP::stop_station()
+{
+  WiFi.setAutoReconnect(false);
+  WiFi.disconnect(true);
+  return (!WiFi.isConnected() && WiFi.getMode() == WIFI_OFF);
+}
+
+void WiHomeNetworkESP::start_station(const char* ssid, const char* password, const char* hostname)
+{
+  WiFi.begin(ssid, password);
+  WiFi.hostname(hostname);
+  WiFi.setAutoReconnect(true);
+}
+
+bool WiHomeNetworkESP::station_connected()
+{
+  return (WiFi.status() == WL_CONNECTED && (WiFi.getMode() & WIFI_STA));
+}
+
+IPAddress WiHomeNetworkESP::local_ip()
+{
+  return WiFi.localIP();
+}
+
+IPAddress WiHomeNetworkESP::broadcast_ip()
+{
+  IPAddress ip = WiFi.localIP();
+  IPAddress subnetmask = WiFi.subnetMask();
+  IPAddress broadcast(0,0,0,0);
+  for (int n=0; n<4; n++)
+    broadcast[n] = (ip[n] & subnetmask[n]) | ~subnetmask[n];
+  return broadcast;
+}
+
+String WiHomeNetworkESP::hostname()
+{
+  return WiFi.hostname();
+}
+
+bool WiHomeNetworkESP::start_softap_station(const char* ssid_softap)
+{
+  IPAddress apIP(192, 168, 4, 1);
+  IPAddress netMsk(255, 255, 255, 0);
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.softAPConfig(apIP, apIP, netMsk);
+  return WiFi.softAP(ssid_softap);
+}
+
+bool WiHomeNetworkESP::stop_softap_station()
+{
+  return WiFi.softAPdisconnect(true);
+}
+
+IPAddress WiHomeNetworkESP::softap_ip()
+{
+  return WiFi.softAPIP();
+}
+
+int32_t WiHomeNetworkESP::rssi()
+{
+  return WiFi.RSSI();
+}
+
+void WiHomeNetworkESP::bssid(uint8_t* target)
+{
+  uint8_t* _bssid = WiFi.BSSID();
+  if (_bssid)
+    memcpy(target, _bssid, 6);
+  else
+    memset(target, 0, 6);
+}
+
+void WiHomeNetworkESP::roam_station(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel)
+{
+  // Reassociates the station only; IP, UDP, mDNS and OTA stay set up. The BSSID is
+  // not written to flash, a reboot starts without the pin:
+  bool persistent = WiFi.getPersistent();
+  WiFi.persistent(false);
+  WiFi.begin(ssid, password, channel, bssid, true);
+  WiFi.persistent(persistent);
+}
+
+void WiHomeNetworkESP::release_bssid()
+{
+  // Clear the pin in the current config only, without a new association, so that
+  // the SDK auto-reconnect is not bound to an access point that may go away:
+  struct station_config config;
+  if (wifi_station_get_config(&config) && config.bssid_set)
+  {
+    config.bssid_set = 0;
+    wifi_station_set_config_current(&config);
+  }
+}
+
+bool WiHomeNetworkESP::start_scan()
+{
+  return (WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING);
+}
+
+int WiHomeNetworkESP::scan_complete()
+{
+  int N = WiFi.scanComplete();
+  if (N == WIFI_SCAN_RUNNING)
+    return WIHOMENETWORK_SCAN_RUNNING;
+  if (N < 0)
+    return WIHOMENETWORK_SCAN_FAILED;
+  return N;
+}
+
+bool WiHomeNetworkESP::scan_result(int n, WiHomeScanResult* result)
+{
+  uint8_t* _bssid = WiFi.BSSID(n);
+  if (!_bssid)
+    return false;
+  strncpy(result->ssid, WiFi.SSID(n).c_str(), sizeof(result->ssid) - 1);
+  result->ssid[sizeof(result->ssid) - 1] = 0;
+  result->rssi = WiFi.RSSI(n);
+  memcpy(result->bssid, _bssid, 6);
+  result->channel = WiFi.channel(n);
+  result->secure = (WiFi.encryptionType(n) != ENC_TYPE_NONE);
+  return true;
+}
+
+void WiHomeNetworkESP::scan_delete()
+{
+  WiFi.scanDelete();
+}
+
+bool WiHomeNetworkESP::mdns_running()
+{
+  return MDNS.isRunning();
+}
+
+bool WiHomeNetworkESP::stop_mdns()
+{
+  MDNS.removeService("esp");
+  return MDNS.end();
+}
+
+bool WiHomeNetworkESP::start_mdns(const char* hostname)
+{
+  if (!MDNS.begin(hostname))
+    return false;
+  MDNS.addService("esp", "tcp", 8080); // Announce esp tcp service on port 8080
+  return true;
+}
+
+void WiHomeNetworkESP::start_ota(const char* hostname, const char* password, WiHomeOTA* ota)
+{
+  ArduinoOTA.setPort(8266);
+  ArduinoOTA.setHostname(hostname);
+  if (password)
+    ArduinoOTA.setPassword(password);
+  ArduinoOTA.onStart([ota]() { ota->push_start(); });
+  ArduinoOTA.onProgress([ota](unsigned int done, unsigned int total) { ota->push_progress(done, total); });
+  ArduinoOTA.onEnd([ota]() { ota->push_end(); });
+  ArduinoOTA.onError([ota](ota_error_t error) {
+    const char* reasons[] = {"auth", "begin", "connect", "receive", "end"};
+    ota->push_error(((unsigned) error < 5) ? reasons[error] : "unknown");
+  });
+  ArduinoOTA.begin();
+}
+
+void WiHomeNetworkESP::handle_ota()
+{
+  ArduinoOTA.handle();
+}
+
+Client* WiHomeNetworkESP::update_client()
+{
+  return &update_wifi_client;
+}
+
+bool WiHomeNetworkESP::update_begin(size_t size)
+{
+  return Update.begin(size);
+}
+
+size_t WiHomeNetworkESP::update_write(const uint8_t* data, size_t length)
+{
+  return Update.write((uint8_t*) data, length);
+}
+
+bool WiHomeNetworkESP::update_end()
+{
+  return Update.end();
+}
+
+void WiHomeNetworkESP::update_abort()
+{
+  // end() without evenIfRemaining discards an incomplete image:
+  Update.end(false);
+}
+
+void WiHomeNetworkESP::restart()
+{
+  ESP.restart();
+}
+
+bool WiHomeNetworkESP::has_web_server()
+{
+  return true;
+}
+
+bool WiHomeNetworkESP::begin_udp(unsigned int port)
+{
+  return Udp.begin(port);
+}
+
+void WiHomeNetworkESP::stop_udp()
+{
+  Udp.stop();
+}
+
+int WiHomeNetworkESP::parse_packet()
+{
+  return Udp.parsePacket();
+}
+
+int WiHomeNetworkESP::read(char* buffer, size_t size)
+{
+  return Udp.read(buffer, size);
+}
+
+IPAddress WiHomeNetworkESP::remote_ip()
+{
+  return Udp.remoteIP();
+}
+
+bool WiHomeNetworkESP::begin_packet(IPAddress ip, unsigned int port)
+{
+  return Udp.beginPacket(ip, port);
+}
+
+bool WiHomeNetworkESP::end_packet()
+{
+  return Udp.endPacket();
+}
+
+size_t WiHomeNetworkESP::write(uint8_t c)
+{
+  return Udp.write(c);
+}
+
+size_t WiHomeNetworkESP::write(const uint8_t* buffer, size_t size)
+{
+  return Udp.write(buffer, size);
+}
@@ -0,0 +1,133 @@
+// WiHome Network Interface Class
+//
+// Station, service, UDP and firmware update functions used by WiHomeComm. WiHomeNetworkESP is the
+// default implementation on the ESP8266 global WiFi, MDNS and ArduinoOTA objects;
+// other implementations (e.g. extras/host) allow several WiHomeComm objects per
+// process. Packets are written through the Print interface between
+// begin_packet() and end_packet(), like with WiFiUDP.
+#include <ESP8266WiFi.h>
+#include <ESP8266mDNS.h>
+#include <WiFiUdp.h>
+#include <ArduinoOTA.h>
+#include "Arduino.h"
+
+#ifndef WIHOMENETWORK_H
+#define WIHOMENETWORK_H
+
+class WiHomeOTA;
+
+#define WIHOMENETWORK_SCAN_RUNNING -1
+#define WIHOMENETWORK_SCAN_FAILED -2
+
+struct WiHomeScanResult
+{
+  char ssid[33];
+  int32_t rssi;
+  uint8_t bssid[6];
+  int32_t channel;
+  bool secure;
+};
+
+class WiHomeNetwork : public Print
+{
+  public:
+    virtual ~WiHomeNetwork() {}
+    // Station connection:
+    virtual bool station_mode() = 0;
+    virtual bool softap_mode() = 0; // Soft AP up, with or without the station interface
+    virtual bool stop_softap() = 0;
+    virtual bool stop_station() = 0; // true if the station is disconnected and off
+    virtual void start_station(const char* ssid, const char* password, const char* hostname) = 0;
+    virtual bool station_connected() = 0;
+    virtual IPAddress local_ip() = 0;
+    virtual IPAddress broadcast_ip() = 0;
+    virtual String hostname() = 0;
+    // Soft AP next to the station connection (AP+STA) for the live config portal:
+    virtual bool start_softap_station(const char* ssid_softap) = 0; // Soft AP on 192.168.4.1
+    virtual bool stop_softap_station() = 0; // Back to station mode, the station stays connected
+    virtual IPAddress softap_ip() = 0;
+    // Link quality and roaming:
+    virtual int32_t rssi() = 0;
+    virtual void bssid(uint8_t* target) = 0; // 6 bytes
+    virtual void roam_station(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel) = 0;
+    virtual void release_bssid() = 0; // After a roam: reconnects may use any access point of the SSID again
+    virtual bool start_scan() = 0; // Asynchronous scan
+    virtual int scan_complete() = 0; // Number of networks found or WIHOMENETWORK_SCAN_RUNNING/FAILED
+    virtual bool scan_result(int n, WiHomeScanResult* result) = 0;
+    virtual void scan_delete() = 0;
+    // Services:
+    virtual bool mdns_running() = 0;
+    virtual bool stop_mdns() = 0;
+    virtual bool start_mdns(const char* hostname) = 0;
+    // Reports pushed updates to ota; pushes need the password unless it is NULL:
+    virtual void start_ota(const char* hostname, const char* password, WiHomeOTA* ota) = 0;
+    virtual void handle_ota() = 0;
+    // Firmware updates pulled over HTTP (see WiHomeOTA):
+    virtual Client* update_client() = 0;
+    virtual bool update_begin(size_t size) = 0;
+    virtual size_t update_write(const uint8_t* data, size_t length) = 0;
+    virtual bool update_end() = 0; // Verifies the image and activates it for the next boot
+    virtual void update_abort() = 0;
+    virtual void restart() = 0;
+    virtual bool has_web_server() = 0; // Main and config web servers on port 80
+    // UDP:
+    virtual bool begin_udp(unsigned int port) = 0;
+    virtual void stop_udp() = 0;
+    virtual int parse_packet() = 0;
+    virtual int read(char* buffer, size_t size) = 0;
+    virtual IPAddress remote_ip() = 0;
+    virtual bool begin_packet(IPAddress ip, unsigned int port) = 0;
+    virtual bool end_packet() = 0;
+    using Print::write;
+};
+
+class WiHomeNetworkESP : public WiHomeNetwork
+{
+  private:
+    WiFiUDP Udp;
+    WiFiClient update_wifi_client;
+  public:
+    bool station_mode();
+    bool softap_mode();
+    bool stop_softap();
+    bool stop_station();
+    void start_station(const char* ssid, const char* password, const char* hostname);
+    bool station_connected();
+    IPAddress local_ip();
+    IPAddress broadcast_ip();
+    String hostname();
+    bool start_softap_station(const char* ssid_softap);
+    bool stop_softap_station();
+    IPAddress softap_ip();
+    int32_t rssi();
+    void bssid(uint8_t* target);
+    void roam_station(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel);
+    void release_bssid();
+    bool start_scan();
+    int scan_complete();
+    bool scan_result(int n, WiHomeScanResult* result);
+    void scan_delete();
+    bool mdns_running();
+    bool stop_mdns();
+    bool start_mdns(const char* hostname);
+    void start_ota(const char* hostname, const char* password, WiHomeOTA* ota);
+    void handle_ota();
+    Client* update_client();
+    bool update_begin(size_t size);
+    size_t update_write(const uint8_t* data, size_t length);
+    bool update_end();
+    void update_abort();
+    void restart();
+    bool has_web_server();
+    bool begin_udp(unsigned int port);
+    void stop_udp();
+    int parse_packet();
+    int read(char* buffer, size_t size);
+    IPAddress remote_ip();
+    bool begin_packet(IPAddress ip, unsigned int port);
+    bool end_packet();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+};
+
+#endif // WIHOMENETWORK_H
@@ -0,0 +1,336 @@
+// Firmware update state, ArduinoOTA push progress
+// and resumable HTTP pull for WiHome devices
+
+#include "WiHomeOTA.h"
+#include "WiHomeLog.h"
+#include "WiHomeTrace.h"
+
+static const char* const ota_state_names[] = {"idle", "push", "pull", "done", "failed"};
+
+void WiHomeOTA::begin(WiHomeClock* _clock)
+{
+  clock = _clock;
+}
+
+bool WiHomeOTA::active()
+{
+  return (state == WH_OTA_PUSH || state == WH_OTA_PULL);
+}
+
+unsigned int WiHomeOTA::progress()
+{
+  if (total == 0)
+    return 0;
+  return (unsigned long long) done * 100 / total;
+}
+
+unsigned long WiHomeOTA::throughput()
+{
+  if (state == WH_OTA_IDLE)
+    return 0;
+  unsigned long elapsed = (active() ? clock->ms() : t_end) - t_start;
+  if (elapsed == 0)
+    return 0;
+  return (unsigned long long) done * 1000 / elapsed;
+}
+
+void WiHomeOTA::start(byte _state)
+{
+  state = _state;
+  done = 0;
+  total = 0;
+  resumes = 0;
+  retries = 0;
+  retry_mark = 0;
+  error = "";
+  writing = false;
+  logged_percent = 0;
+  t_start = clock->ms();
+  t_end = t_start;
+  WHTRACE_ASYNC_BEGIN("ota", ota_state_names[_state]);
+  if (on_start)
+    on_start();
+}
+
+void WiHomeOTA::finish(byte _state)
+{
+  state = _state;
+  t_end = clock->ms();
+  WHTRACE_ASYNC_END("ota", ota_state_names[_state]);
+  if (state == WH_OTA_DONE)
+    WHLOG_INFO("Firmware update: %u bytes in %lu ms (%lu bytes/s, %u resumes).\n",
+               (unsigned) done, t_end - t_start, throughput(), resumes);
+}
+
+void WiHomeOTA::fail(WiHomeNetwork* network, const char* reason)
+{
+  if (network)
+  {
+    network->update_client()->stop();
+    if (writing)
+      network->update_abort();
+  }
+  writing = false;
+  error = reason;
+  WHLOG_ERROR("[ERROR] Firmware update failed at %u bytes: %s\n", (unsigned) done, reason);
+  finish(WH_OTA_FAILED);
+}
+
+void WiHomeOTA::log_progress()
+{
+  unsigned int percent = progress();
+  if (percent >= logged_percent + WIHOMEOTA_PROGRESS_STEP)
+  {
+    logged_percent = percent - percent % WIHOMEOTA_PROGRESS_STEP;
+    WHLOG_INFO("Firmware update: %u%% (%lu bytes/s)\n", logged_percent, throughput());
+  }
+}
+
+void WiHomeOTA::push_start()
+{
+  WHLOG_INFO("Firmware upload started.\n");
+  start(WH_OTA_PUSH);
+}
+
+void WiHomeOTA::push_progress(size_t _done, size_t _total)
+{
+  done = _done;
+  total = _total;
+  log_progress();
+}
+
+void WiHomeOTA::push_end()
+{
+  finish(WH_OTA_DONE);
+}
+
+void WiHomeOTA::push_error(const char* reason)
+{
+  fail(NULL, reason);
+}
+
+bool WiHomeOTA::parse_url(const char* url)
+{
+  // Only plain http to a local server, e.g. http://192.168.1.10:8000/firmware.bin.gz
+  if (strncmp(url, "http://", 7) != 0)
+    return false;
+  const char* p = url + 7;
+  const char* slash = strchr(p, '/');
+  if (!slash)
+    slash = p + strlen(p);
+  const char* colon = (const char*) memchr(p, ':', slash - p);
+  const char* host_end = colon ? colon : slash;
+  if (host_end == p || (size_t) (host_end - p) >= sizeof(host) || strlen(slash) >= sizeof(path))
+    return false;
+  memcpy(host, p, host_end - p);
+  host[host_end - p] = 0;
+  port = colon ? atoi(colon + 1) : 80;
+  strcpy(path, *slash ? slash : "/");
+  return (port != 0);
+}
+
+bool WiHomeOTA::pull(const char* url)
+{
+  if (active())
+    return false;
+  if (!parse_url(url))
+  {
+    WHLOG_ERROR("[ERROR] Invalid update URL: %s\n", url);
+    return false;
+  }
+  WHLOG_INFO("Firmware download from %s\n", url);
+  pull_state = PULL_CONNECT;
+  start(WH_OTA_PULL);
+  return true;
+}
+
+void WiHomeOTA::interrupted(WiHomeNetwork* network, Client* client)
+{
+  client->stop();
+  resumes++;
+  if (done > retry_mark)
+  {
+    retry_mark = done;
+    retries = 0;
+  }
+  if (++retries > WIHOMEOTA_MAX_RETRIES)
+  {
+    fail(network, "download interrupted");
+    return;
+  }
+  WHLOG_WARN("Firmware download interrupted at %u bytes, resuming.\n", (unsigned) done);
+  t_data = clock->ms();
+  pull_state = PULL_CONNECT;
+}
+
+void WiHomeOTA::parse_header_line()
+{
+  if (status_code == 0)
+  {
+    // Status line, e.g. "HTTP/1.1 206 Partial Content":
+    const char* space = strchr(line, ' ');
+    status_code = space ? atoi(space + 1) : -1;
+  }
+  else if (strncasecmp(line, "Content-Length:", 15) == 0)
+    content_length = strtoul(line + 15, NULL, 10);
+  else if (strncasecmp(line, "Content-Range:", 14) == 0)
+  {
+    // "Content-Range: bytes <start>-<end>/<total>"
+    const char* p = strstr(line + 14, "bytes");
+    const char* slash = strchr(line, '/');
+    if (p && slash)
+    {
+      range_start = strtoul(p + 5, NULL, 10);
+      range_total = strtoul(slash + 1, NULL, 10);
+    }
+  }
+}
+
+bool WiHomeOTA::start_body(WiHomeNetwork* network)
+{
+  if (status_code == 206 && done > 0)
+  {
+    if (range_start != done || range_total != total)
+    {
+      fail(network, "unexpected Content-Range");
+      return false;
+    }
+  }
+  else if (status_code == 200)
+  {
+    if (content_length == 0)
+    {
+      fail(network, "no Content-Length");
+      return false;
+    }
+    if (writing)
+    {
+      // The server does not support ranges, start over:
+      WHLOG_WARN("Server ignored Range request, restarting download.\n");
+      network->update_abort();
+      writing = false;
+      done = 0;
+      logged_percent = 0;
+    }
+    total = content_length;
+    if (!network->update_begin(total))
+    {
+      fail(network, "image does not fit");
+      return false;
+    }
+    writing = true;
+  }
+  else
+  {
+    fail(network, "unexpected HTTP status");
+    return false;
+  }
+  pull_state = PULL_BODY;
+  return true;
+}
+
+void WiHomeOTA::check(WiHomeNetwork* network)
+{
+  if (state != WH_OTA_PULL)
+    return;
+  Client* client = network->update_client();
+  unsigned long now = clock->ms();
+  switch (pull_state)
+  {
+    case PULL_CONNECT:
+      if (resumes > 0 && now - t_data < WIHOMEOTA_RETRY_DELAY)
+        return;
+      if (!client->connect(host, port))
+      {
+        interrupted(network, client);
+        return;
+      }
+      client->printf("GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: WiHomeComm\r\nConnection: close\r\n", path, host);
+      if (done > 0)
+        client->printf("Range: bytes=%u-\r\n", (unsigned) done);
+      client->print("\r\n");
+      line_length = 0;
+      status_code = 0;
+      content_length = 0;
+      range_start = 0;
+      range_total = 0;
+      t_data = now;
+      pull_state = PULL_HEADERS;
+      break;
+    case PULL_HEADERS:
+      for (int n=0; n<WIHOMEOTA_CHUNK && client->available(); n++)
+      {
+        int c = client->read();
+        t_data = now;
+        if (c == '\n')
+        {
+          if (line_length > 0 && line[line_length-1] == '\r')
+            line_length--;
+          line[line_length] = 0;
+          if (line_length == 0)
+          {
+            start_body(network);
+            return;
+          }
+          parse_header_line();
+          line_length = 0;
+        }
+        else if (line_length < sizeof(line) - 1)
+          line[line_length++] = c;
+      }
+      if (!client->available() && !client->connected())
+        interrupted(network, client);
+      break;
+    case PULL_BODY:
+      if (client->available())
+      {
+        uint8_t buffer[WIHOMEOTA_CHUNK];
+        size_t remaining = total - done;
+        int length = client->read(buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer));
+        if (length > 0)
+        {
+          t_data = now;
+          if (network->update_write(buffer, length) != (size_t) length)
+          {
+            fail(network, "write error");
+            return;
+          }
+          done += length;
+          log_progress();
+          if (done >= total)
+          {
+            client->stop();
+            writing = false;
+            if (network->update_end())
+              finish(WH_OTA_DONE);
+            else
+              fail(network, "image verification");
+            return;
+          }
+        }
+      }
+      else if (!client->connected())
+        interrupted(network, client);
+      break;
+  }
+  if (state == WH_OTA_PULL && pull_state != PULL_CONNECT && now - t_data > WIHOMEOTA_TIMEOUT)
+    interrupted(network, client);
+}
+
+void WiHomeOTA::abort(WiHomeNetwork* network)
+{
+  if (state == WH_OTA_PULL)
+    fail(network, "aborted");
+}
+
+size_t WiHomeOTA::format_json(char* str, size_t size)
+{
+  unsigned long elapsed = (active() ? clock->ms() : t_end) - t_start;
+  int length = snprintf(str, size, "{\"state\":\"%s\",\"done\":%lu,\"total\":%lu,\"progress\":%u,"
+                        "\"throughput\":%lu,\"elapsed\":%lu,\"resumes\":%u,\"error\":\"%s\"}",
+                        ota_state_names[state], (unsigned long) done, (unsigned long) total, progress(),
+                        throughput(), elapsed, resumes, error);
+  if (length < 0)
+    return 0;
+  return ((size_t) length < size) ? length : size - 1;
+}
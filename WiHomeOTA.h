@@ -0,0 +1,84 @@
+// WiHome Firmware Update Class
+//
+// State and progress of a firmware update, either pushed by espota/ArduinoOTA
+// (push_*() callbacks) or pulled by the device from a local HTTP server
+// (pull() and check()). The pull reads one chunk per check(), continues an
+// interrupted download with a Range request and hands the image to the update
+// functions of WiHomeNetwork; gzip compressed images are written as they are and
+// unpacked by the ESP8266 bootloader.
+#include "Arduino.h"
+#include <functional>
+#include "WiHomeNetwork.h"
+#include "WiHomeClock.h"
+
+#ifndef WIHOMEOTA_H
+#define WIHOMEOTA_H
+
+#define WIHOMEOTA_CHUNK 512 // Bytes read from the HTTP connection per check()
+#define WIHOMEOTA_TIMEOUT 10000 //ms without data before the download is resumed
+#define WIHOMEOTA_RETRY_DELAY 1000 //ms between an interruption and the Range request
+#define WIHOMEOTA_MAX_RETRIES 8 // Consecutive interruptions without progress before giving up
+#define WIHOMEOTA_PROGRESS_STEP 10 //%, granularity of progress log messages
+
+enum WIHOME_OTA_STATES
+{
+  WH_OTA_IDLE,   // 0
+  WH_OTA_PUSH,   // 1: ArduinoOTA upload in progress
+  WH_OTA_PULL,   // 2: HTTP download in progress
+  WH_OTA_DONE,   // 3: Image complete and verified, restart pending
+  WH_OTA_FAILED, // 4
+};
+
+class WiHomeOTA
+{
+  private:
+    WiHomeClock* clock = NULL;
+    enum { PULL_CONNECT, PULL_HEADERS, PULL_BODY } pull_state = PULL_CONNECT;
+    char host[64];
+    uint16_t port = 80;
+    char path[128];
+    char line[128]; // HTTP response header line being assembled
+    unsigned int line_length = 0;
+    int status_code = 0;
+    unsigned long content_length = 0;
+    unsigned long range_start = 0;
+    unsigned long range_total = 0;
+    bool writing = false; // update_begin() succeeded, image not finished yet
+    unsigned long t_data = 0; // Last time data was received
+    unsigned int logged_percent = 0;
+    unsigned int retries = 0; // Interruptions without getting past retry_mark
+    size_t retry_mark = 0; // Bytes written at the last interruption
+    void start(byte _state);
+    void finish(byte _state);
+    void fail(WiHomeNetwork* network, const char* reason);
+    void log_progress();
+    bool parse_url(const char* url);
+    void parse_header_line();
+    bool start_body(WiHomeNetwork* network);
+    void interrupted(WiHomeNetwork* network, Client* client);
+  public:
+    byte state = WH_OTA_IDLE;
+    size_t done = 0; // Bytes written
+    size_t total = 0; // Image size, 0 if not known yet
+    unsigned long t_start = 0;
+    unsigned long t_end = 0;
+    unsigned int resumes = 0; // Interrupted downloads continued with a Range request
+    const char* error = "";
+    std::function<void()> on_start; // Called when an update begins, to pause other services
+    void begin(WiHomeClock* _clock);
+    bool active(); // Push or pull in progress
+    unsigned int progress(); // %
+    unsigned long throughput(); // Bytes/s
+    // ArduinoOTA callbacks:
+    void push_start();
+    void push_progress(size_t _done, size_t _total);
+    void push_end();
+    void push_error(const char* reason);
+    // HTTP pull from http://host[:port]/path:
+    bool pull(const char* url);
+    void check(WiHomeNetwork* network);
+    void abort(WiHomeNetwork* network);
+    size_t format_json(char* str, size_t size);
+};
+
+#endif // WIHOMEOTA_H
@@ -0,0 +1,118 @@
+// Asynchronous access point scan with cached,
+// deduplicated and sorted results
+
+#include "WiHomeScan.h"
+#include "WiHomeLog.h"
+#include "WiHomeTrace.h"
+
+void WiHomeScan::begin(WiHomeClock* _clock)
+{
+  clock = _clock;
+}
+
+bool WiHomeScan::start(WiHomeNetwork* network)
+{
+  if (running || fresh())
+    return false;
+  if (!network->start_scan())
+  {
+    WHLOG_WARN("Network scan could not be started.\n");
+    return false;
+  }
+  running = true;
+  WHTRACE_ASYNC_BEGIN("network_scan");
+  return true;
+}
+
+bool WiHomeScan::check(WiHomeNetwork* network)
+{
+  if (!running)
+    return false;
+  int N = network->scan_complete();
+  if (N == WIHOMENETWORK_SCAN_RUNNING)
+    return false;
+  running = false;
+  WHTRACE_ASYNC_END("network_scan");
+  if (N == WIHOMENETWORK_SCAN_FAILED)
+  {
+    WHLOG_WARN("Network scan failed.\n");
+    return false;
+  }
+  N_networks = 0;
+  WiHomeScanResult result;
+  for (int n=0; n<N; n++)
+    if (network->scan_result(n, &result) && result.ssid[0])
+      insert(result);
+  network->scan_delete();
+  valid = true;
+  t_scan = clock->ms();
+  scans++;
+  WHLOG_INFO("Network scan: %d access points, %u networks.\n", N, N_networks);
+  return true;
+}
+
+void WiHomeScan::insert(const WiHomeScanResult& result)
+{
+  // One entry per SSID (the strongest access point):
+  unsigned int n = 0;
+  while (n < N_networks && strcmp(networks[n].ssid, result.ssid) != 0)
+    n++;
+  if (n < N_networks)
+  {
+    if (result.rssi <= networks[n].rssi)
+      return;
+    // Remove the weaker entry, the stronger one is inserted below:
+    for (; n+1 < N_networks; n++)
+      networks[n] = networks[n+1];
+    N_networks--;
+  }
+  // Insertion sort by RSSI, strongest first; the weakest falls off a full list:
+  n = N_networks;
+  while (n > 0 && networks[n-1].rssi < result.rssi)
+  {
+    if (n < WIHOMESCAN_MAX_NETWORKS)
+      networks[n] = networks[n-1];
+    n--;
+  }
+  if (n < WIHOMESCAN_MAX_NETWORKS)
+  {
+    networks[n] = result;
+    if (N_networks < WIHOMESCAN_MAX_NETWORKS)
+      N_networks++;
+  }
+}
+
+void WiHomeScan::cancel(WiHomeNetwork* network)
+{
+  if (running)
+  {
+    network->scan_delete();
+    running = false;
+    WHTRACE_ASYNC_END("network_scan", "cancelled");
+  }
+}
+
+bool WiHomeScan::scanning()
+{
+  return running;
+}
+
+bool WiHomeScan::fresh()
+{
+  return valid && (age() < WIHOMESCAN_TTL);
+}
+
+unsigned long WiHomeScan::age()
+{
+  return clock->ms() - t_scan;
+}
+
+unsigned int WiHomeScan::size()
+{
+  return N_networks;
+}
+
+const WiHomeScanResult& WiHomeScan::network(unsigned int n)
+{
+  return networks[n];
+}
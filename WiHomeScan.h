@@ -0,0 +1,40 @@
+// WiHome Network Scan Cache Class
+//
+// Scans for access points in the background (start()/check()) and keeps the
+// result, one entry per SSID with the strongest signal, sorted by RSSI. The config
+// portal renders its network picker and /networks.json from the cache instead of
+// a blocking scan; results older than WIHOMESCAN_TTL trigger a new scan.
+#include "Arduino.h"
+#include "WiHomeNetwork.h"
+#include "WiHomeClock.h"
+
+#ifndef WIHOMESCAN_H
+#define WIHOMESCAN_H
+
+#define WIHOMESCAN_MAX_NETWORKS 12 // Strongest networks kept
+#define WIHOMESCAN_TTL 60000 //ms, age after which results are refreshed
+
+class WiHomeScan
+{
+  private:
+    WiHomeClock* clock = NULL;
+    WiHomeScanResult networks[WIHOMESCAN_MAX_NETWORKS];
+    unsigned int N_networks = 0;
+    bool running = false;
+    bool valid = false; // At least one scan completed
+    unsigned long t_scan = 0; // Completion time of the last scan
+    void insert(const WiHomeScanResult& result);
+  public:
+    unsigned long scans = 0;
+    void begin(WiHomeClock* _clock);
+    bool start(WiHomeNetwork* network); // Starts a scan unless one runs or the results are fresh
+    bool check(WiHomeNetwork* network); // True when new results arrived
+    void cancel(WiHomeNetwork* network);
+    bool scanning();
+    bool fresh(); // Results younger than WIHOMESCAN_TTL
+    unsigned long age(); // ms since the last scan completed
+    unsigned int size();
+    const WiHomeScanResult& network(unsigned int n); // Strongest first
+};
+
+#endif // WIHOMESCAN_H
@@ -0,0 +1,59 @@
+// ConfigFileJSON implementation of the storage interface
+// for WiHome devices
+
+#include "WiHomeStorage.h"
+
+WiHomeConfigFile::WiHomeConfigFile(const char* filename)
+{
+  config = new ConfigFileJSON(filename);
+}
+
+WiHomeConfigFile::~WiHomeConfigFile()
+{
+  delete config;
+}
+
+bool WiHomeConfigFile::is_valid_file()
+{
+  return config->is_valid_file();
+}
+
+void WiHomeConfigFile::get(const char* name, char* value)
+{
+  config->get(name, value);
+}
+
+void WiHomeConfigFile::get(const char* name, float* value)
+{
+  config->get(name, value);
+}
+
+void WiHomeConfigFile::get(const char* name, bool* value)
+{
+  config->get(name, value);
+}
+
+void WiHomeConfigFile::set_nowrite(const char* name, const char* value)
+{
+  config->set_nowrite(name, value);
+}
+
+void WiHomeConfigFile::set_nowrite(const char* name, float value)
+{
+  config->set_nowrite(name, value);
+}
+
+void WiHomeConfigFile::set_nowrite(const char* name, bool value)
+{
+  config->set_nowrite(name, value);
+}
+
+void WiHomeConfigFile::write()
+{
+  config->set("dummy", 0); // ConfigFileJSON writes the file on set()
+}
+
+void WiHomeConfigFile::dump()
+{
+  config->dump();
+}
@@ -0,0 +1,44 @@
+// WiHome Storage Interface Class
+//
+// Persistent storage of the config parameters. WiHomeConfigFile is the default
+// implementation on a ConfigFileJSON file in SPIFFS.
+#include "Arduino.h"
+#include "ConfigFileJSON.h"
+
+#ifndef WIHOMESTORAGE_H
+#define WIHOMESTORAGE_H
+
+class WiHomeStorage
+{
+  public:
+    virtual ~WiHomeStorage() {}
+    virtual bool is_valid_file() = 0;
+    virtual void get(const char* name, char* value) = 0;
+    virtual void get(const char* name, float* value) = 0;
+    virtual void get(const char* name, bool* value) = 0;
+    virtual void set_nowrite(const char* name, const char* value) = 0;
+    virtual void set_nowrite(const char* name, float value) = 0;
+    virtual void set_nowrite(const char* name, bool value) = 0;
+    virtual void write() = 0; // Write all values set with set_nowrite()
+    virtual void dump() = 0;
+};
+
+class WiHomeConfigFile : public WiHomeStorage
+{
+  private:
+    ConfigFileJSON* config;
+  public:
+    WiHomeConfigFile(const char* filename);
+    ~WiHomeConfigFile();
+    bool is_valid_file();
+    void get(const char* name, char* value);
+    void get(const char* name, float* value);
+    void get(const char* name, bool* value);
+    void set_nowrite(const char* name, const char* value);
+    void set_nowrite(const char* name, float value);
+    void set_nowrite(const char* name, bool value);
+    void write();
+    void dump();
+};
+
+#endif // WIHOMESTORAGE_H
@@ -0,0 +1,137 @@
+// Hub clock offset and drift estimation
+// from the findhub/hubid exchange
+
+#include "WiHomeSync.h"
+#include "WiHomeLog.h"
+
+void WiHomeSync::begin(WiHomeClock* _clock)
+{
+  clock = _clock;
+}
+
+void WiHomeSync::reset()
+{
+  t_request = 0;
+  offset = 0;
+  t_offset = 0;
+  drift = 0;
+  min_round_trip = 0xffffffff;
+  samples = 0;
+  round_trip = 0;
+  uplink = 0;
+  downlink = 0;
+}
+
+uint64_t WiHomeSync::local_us()
+{
+  uint32_t now = clock->us();
+  if (now < last_us)
+    wraps_us += 1ULL << 32;
+  last_us = now;
+  return wraps_us + now;
+}
+
+uint64_t WiHomeSync::request()
+{
+  t_request = local_us();
+  return t_request;
+}
+
+bool WiHomeSync::response(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+  // Only the answer to the outstanding request, each only once:
+  if (t1 == 0 || t1 != t_request || t4 < t1 || t3 < t2)
+    return false;
+  t_request = 0;
+  uint64_t hub_time = t3 - t2;
+  uint32_t rt = (t4 - t1 > hub_time) ? (t4 - t1) - hub_time : 0;
+  if (rt < min_round_trip)
+    min_round_trip = rt;
+  else
+    min_round_trip += (rt - min_round_trip) / 16;
+  if (samples >= WIHOMESYNC_MIN_SAMPLES && rt > 2 * min_round_trip + WIHOMESYNC_ROUND_TRIP_SLACK)
+  {
+    rejected++;
+    WHLOG_DEBUG("Clock sync: round trip %lu us rejected.\n", (unsigned long) rt);
+    return false;
+  }
+  round_trip = rt;
+  int64_t measured = ((int64_t) (t2 - t1) + ((int64_t) t3 - (int64_t) t4)) / 2;
+  if (samples == 0)
+  {
+    uplink = rt / 2;
+    downlink = rt / 2;
+  }
+  else
+  {
+    // One-way latencies against the clock model before this exchange:
+    uplink = (int64_t) (t2 - to_hub(t1));
+    downlink = (int64_t) (to_hub(t4) - t3);
+  }
+  if (samples < WIHOMESYNC_MIN_SAMPLES)
+  {
+    // Fast initial exchanges: the one with the smallest round trip sets the offset
+    if (rt <= min_round_trip)
+    {
+      offset = measured;
+      t_offset = t4;
+    }
+  }
+  else
+  {
+    // Phase and frequency correction from the prediction error:
+    double dt = t4 - t_offset;
+    int64_t predicted = offset + (int64_t) (drift * 1e-6 * dt);
+    int64_t error = measured - predicted;
+    if (dt > 0)
+      drift += WIHOMESYNC_ALPHA * error / dt * 1e6;
+    if (drift > WIHOMESYNC_MAX_DRIFT)
+      drift = WIHOMESYNC_MAX_DRIFT;
+    if (drift < -WIHOMESYNC_MAX_DRIFT)
+      drift = -WIHOMESYNC_MAX_DRIFT;
+    offset = predicted + (int64_t) (WIHOMESYNC_ALPHA * error);
+    t_offset = t4;
+  }
+  samples++;
+  WHLOG_DEBUG("Clock sync: round trip %lu us, drift %d ppm.\n", (unsigned long) rt, (int) drift);
+  return true;
+}
+
+bool WiHomeSync::synchronized()
+{
+  return (samples >= WIHOMESYNC_MIN_SAMPLES);
+}
+
+uint64_t WiHomeSync::to_hub(uint64_t local)
+{
+  return local + offset + (int64_t) (drift * 1e-6 * (double) ((int64_t) (local - t_offset)));
+}
+
+uint64_t WiHomeSync::hub_us()
+{
+  return to_hub(local_us());
+}
+
+int64_t WiHomeSync::get_offset()
+{
+  return offset;
+}
+
+double WiHomeSync::get_drift()
+{
+  return drift;
+}
+
+size_t WiHomeSync::format_json(char* str, size_t size)
+{
+  int length = snprintf(str, size, "{\"synchronized\":%s,\"hub_us\":%llu,\"offset_us\":%lld,\"drift_ppm\":%.2f,"
+                        "\"round_trip_us\":%lu,\"min_round_trip_us\":%lu,\"uplink_us\":%ld,\"downlink_us\":%ld,"
+                        "\"samples\":%lu,\"rejected\":%lu}",
+                        synchronized() ? "true" : "false", (unsigned long long) (samples ? hub_us() : 0),
+                        (long long) offset, drift, (unsigned long) round_trip,
+                        (unsigned long) (samples ? min_round_trip : 0), (long) uplink, (long) downlink,
+                        samples, rejected);
+  if (length < 0)
+    return 0;
+  return ((size_t) length < size) ? length : size - 1;
+}
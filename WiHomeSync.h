@@ -0,0 +1,50 @@
+// WiHome Hub Clock Synchronization Class
+//
+// Estimates offset and drift of the local clock against the hub clock from the
+// findhub/hubid heartbeat, NTP-style: findhub carries the local send time t1, the
+// hub answers hubid with t1 echoed and its receive (t2) and send (t3) times, and
+// the device takes t4 when the answer arrives. Exchanges with a round trip far
+// above the recent minimum were queued somewhere and are discarded. Hub times are
+// microseconds (Unix time on the reference hub in extras/hub).
+#include "Arduino.h"
+#include "WiHomeClock.h"
+
+#ifndef WIHOMESYNC_H
+#define WIHOMESYNC_H
+
+#define WIHOMESYNC_ALPHA 0.25 // Weight of a new sample in offset and drift
+#define WIHOMESYNC_ROUND_TRIP_SLACK 2000 //us, accepted round trip above twice the minimum
+#define WIHOMESYNC_MAX_DRIFT 500.0 //ppm, larger drift estimates are clipped
+#define WIHOMESYNC_MIN_SAMPLES 4 // Accepted exchanges before synchronized() is true
+
+class WiHomeSync
+{
+  private:
+    WiHomeClock* clock = NULL;
+    uint32_t last_us = 0;
+    uint64_t wraps_us = 0; // Wraps of the 32 bit microsecond counter
+    uint64_t t_request = 0; // t1 of the outstanding findhub, 0 if none
+    int64_t offset = 0; // Hub time minus local time at t_offset, us
+    uint64_t t_offset = 0;
+    double drift = 0; // ppm, hub clock relative to the local clock
+    uint32_t min_round_trip = 0xffffffff; // Slowly forgets, to follow changed paths
+  public:
+    unsigned long samples = 0; // Accepted exchanges
+    unsigned long rejected = 0; // Discarded because of queuing delay
+    uint32_t round_trip = 0; // us, of the last accepted exchange
+    int32_t uplink = 0; // us, device to hub latency estimated from the clock model
+    int32_t downlink = 0; // us, hub to device
+    void begin(WiHomeClock* _clock);
+    void reset();
+    uint64_t local_us(); // 64 bit local time, must be called at least every 71 minutes
+    uint64_t request(); // t1 for the next findhub
+    bool response(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+    bool synchronized();
+    uint64_t to_hub(uint64_t local); // Converts local_us() to hub time
+    uint64_t hub_us(); // Current hub time
+    int64_t get_offset(); // us
+    double get_drift(); // ppm
+    size_t format_json(char* str, size_t size);
+};
+
+#endif // WIHOMESYNC_H
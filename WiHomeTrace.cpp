@@ -0,0 +1,117 @@
+// Class for recording timelines as Chrome trace events
+// for WiHome devices
+
+#include "WiHomeTrace.h"
+
+WiHomeTrace wihome_trace;
+
+void WiHomeTrace::set_clock(WiHomeClock* _clock)
+{
+  clock = _clock;
+}
+
+void WiHomeTrace::record(char phase, const char* name, const char* detail)
+{
+  if (N_events == WIHOMETRACE_BUFFER_SIZE)
+  {
+    n_dropped++;
+    return;
+  }
+  events[N_events].timestamp = clock ? clock->us() : micros();
+  events[N_events].name = name;
+  events[N_events].detail = detail;
+  events[N_events].phase = phase;
+  N_events++;
+}
+
+void WiHomeTrace::clear()
+{
+  N_events = 0;
+  n_dropped = 0;
+}
+
+unsigned int WiHomeTrace::size()
+{
+  return N_events;
+}
+
+unsigned long WiHomeTrace::dropped()
+{
+  return n_dropped;
+}
+
+static int append_escaped(char* str, size_t size, int length, const char* value)
+{
+  // JSON string contents; details like SSIDs can hold any character:
+  for (; *value && length >= 0 && (size_t) length < size; value++)
+  {
+    unsigned char c = *value;
+    if (c == '"' || c == '\\')
+      length += snprintf(&str[length], size - length, "\\%c", c);
+    else if (c < 0x20)
+      length += snprintf(&str[length], size - length, "\\u%04x", c);
+    else
+      length += snprintf(&str[length], size - length, "%c", c);
+  }
+  return length;
+}
+
+static unsigned long async_id(const char* name)
+{
+  // Async begin and end events are matched by id; the same name gives the same id:
+  unsigned long id = 5381;
+  for (; *name; name++)
+    id = (id * 33) ^ (unsigned char) *name;
+  return id & 0xffffffff;
+}
+
+size_t WiHomeTrace::format_event(unsigned int n, char* str, size_t size)
+{
+  if (n >= N_events)
+    return 0;
+  event* e = &events[n];
+  int length = snprintf(str, size, "%s{\"name\":\"", (n>0) ? "," : "");
+  length = append_escaped(str, size, length, e->name);
+  if (length > 0 && (size_t) length < size)
+    length += snprintf(&str[length], size - length, "\",\"ph\":\"%c\",\"ts\":%lu,\"pid\":1,\"tid\":1",
+                       e->phase, e->timestamp);
+  if (e->phase == 'i' && length > 0 && (size_t) length < size)
+    length += snprintf(&str[length], size - length, ",\"s\":\"t\"");
+  if ((e->phase == 'b' || e->phase == 'e') && length > 0 && (size_t) length < size)
+    length += snprintf(&str[length], size - length, ",\"cat\":\"wihome\",\"id\":\"0x%08lx\"",
+                       async_id(e->name));
+  if (e->detail && length > 0 && (size_t) length < size)
+  {
+    length += snprintf(&str[length], size - length, ",\"args\":{\"detail\":\"");
+    length = append_escaped(str, size, length, e->detail);
+    if (length > 0 && (size_t) length < size)
+      length += snprintf(&str[length], size - length, "\"}");
+  }
+  if (length > 0 && (size_t) length < size)
+    length += snprintf(&str[length], size - length, "}");
+  if (length < 0)
+    return 0;
+  return ((size_t) length < size) ? length : size - 1;
+}
+
+const char* WiHomeTrace::json_prefix()
+{
+  return "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+}
+
+const char* WiHomeTrace::json_suffix()
+{
+  return "]}\n";
+}
+
+void WiHomeTrace::dump(Print& out)
+{
+  char str[WIHOMETRACE_EVENT_SIZE];
+  out.print(json_prefix());
+  for (unsigned int n=0; n<N_events; n++)
+  {
+    format_event(n, str, sizeof(str));
+    out.print(str);
+  }
+  out.print(json_suffix());
+}
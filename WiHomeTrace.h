@@ -0,0 +1,70 @@
+// WiHome Trace Class
+//
+// Records a fixed number of timestamped begin/end/instant events, e.g. of the
+// boot and connection timeline, and writes them out as Chrome trace_event JSON
+// (load in chrome://tracing or Perfetto). Events after the buffer is full are
+// counted as dropped. Define WIHOMECOMM_TRACE as 0 to remove all trace points.
+//
+// WHTRACE_BEGIN/END are synchronous spans on the one thread of the device and
+// have to nest strictly (e.g. around a function call). States that overlap each
+// other, like connecting, hub discovery, roaming, scans and updates, use
+// WHTRACE_ASYNC_BEGIN/END; each span name gets its own async track.
+#include "Arduino.h"
+#include "WiHomeClock.h"
+
+#ifndef WIHOMETRACE_H
+#define WIHOMETRACE_H
+
+#ifndef WIHOMECOMM_TRACE
+#define WIHOMECOMM_TRACE 1
+#endif
+#ifndef WIHOMETRACE_BUFFER_SIZE
+#define WIHOMETRACE_BUFFER_SIZE 64 // Number of recorded events
+#endif
+#define WIHOMETRACE_EVENT_SIZE 192 // Maximum length of one formatted event (with a 32 character detail)
+
+#if WIHOMECOMM_TRACE
+#define WHTRACE_BEGIN(...) wihome_trace.record('B', __VA_ARGS__)
+#define WHTRACE_END(...) wihome_trace.record('E', __VA_ARGS__)
+#define WHTRACE_INSTANT(...) wihome_trace.record('i', __VA_ARGS__)
+#define WHTRACE_ASYNC_BEGIN(...) wihome_trace.record('b', __VA_ARGS__)
+#define WHTRACE_ASYNC_END(...) wihome_trace.record('e', __VA_ARGS__)
+#else
+#define WHTRACE_BEGIN(...) do {} while (0)
+#define WHTRACE_END(...) do {} while (0)
+#define WHTRACE_INSTANT(...) do {} while (0)
+#define WHTRACE_ASYNC_BEGIN(...) do {} while (0)
+#define WHTRACE_ASYNC_END(...) do {} while (0)
+#endif
+
+class WiHomeTrace
+{
+  private:
+    struct event
+    {
+      const char* name;
+      const char* detail;
+      unsigned long timestamp; // us
+      char phase;
+    };
+    event events[WIHOMETRACE_BUFFER_SIZE];
+    unsigned int N_events = 0;
+    unsigned long n_dropped = 0;
+    WiHomeClock* clock = NULL; // micros() until set_clock()
+  public:
+    void set_clock(WiHomeClock* _clock);
+    // name and detail have to stay valid (string literals or static storage):
+    void record(char phase, const char* name, const char* detail=NULL);
+    void clear();
+    unsigned int size();
+    unsigned long dropped();
+    // Chrome trace JSON, piecewise for chunked sending: prefix, events, suffix
+    size_t format_event(unsigned int n, char* str, size_t size);
+    const char* json_prefix();
+    const char* json_suffix();
+    void dump(Print& out);
+};
+
+extern WiHomeTrace wihome_trace;
+
+#endif // WIHOMETRACE_H
@@ -0,0 +1,89 @@
+// Fills the static main page shell with the values from /values.json
+function addOption(select, value, text, selected)
+{
+  var option = document.createElement('option');
+  option.value = value;
+  option.text = text;
+  option.selected = selected;
+  select.appendChild(option);
+}
+
+function addParameter(form, para)
+{
+  form.appendChild(document.createElement('br'));
+  form.appendChild(document.createTextNode(para.prompt));
+  form.appendChild(document.createElement('br'));
+  var input;
+  if (para.type == 'bool')
+  {
+    input = document.createElement('select');
+    addOption(input, '0', 'No', para.value == '0');
+    addOption(input, '1', 'Yes', para.value == '1');
+  }
+  else
+  {
+    input = document.createElement('input');
+    input.type = 'text';
+    input.value = para.value;
+  }
+  input.name = para.name;
+  form.appendChild(input);
+}
+
+function showValues(values)
+{
+  document.getElementById('client').textContent = values.client;
+  document.getElementById('html').innerHTML = values.html || '';
+  var form = document.getElementById('paras');
+  // Do not overwrite a parameter the user is currently editing:
+  if (form.contains(document.activeElement))
+    return;
+  form.innerHTML = '';
+  for (var n = 0; n < values.paras.length; n++)
+    addParameter(form, values.paras[n]);
+}
+
+var statusNames = ['Unknown', 'Connected', 'No hub', 'Disconnected', 'SoftAP'];
+
+function showStatus(event)
+{
+  var status = JSON.parse(event.data).status;
+  document.getElementById('status').textContent = statusNames[status] || status;
+}
+
+// Application fields are written into the elements with the same id:
+function showAppFields(event)
+{
+  var fields = JSON.parse(event.data);
+  for (var id in fields)
+  {
+    var element = document.getElementById(id);
+    if (element)
+      element.textContent = fields[id];
+  }
+}
+
+function subscribeEvents()
+{
+  if (!window.EventSource)
+    return;
+  var events = new EventSource('/events');
+  events.addEventListener('status', showStatus);
+  events.addEventListener('values', function(event) { showValues(JSON.parse(event.data)); });
+  events.addEventListener('app', showAppFields);
+}
+
+function loadValues()
+{
+  var request = new XMLHttpRequest();
+  request.onload = function()
+  {
+    if (request.status == 200)
+      showValues(JSON.parse(request.responseText));
+  };
+  request.open('GET', '/values.json');
+  request.send();
+}
+
+loadValues();
+subscribeEvents();
@@ -0,0 +1,646 @@
+// Linux host backend
+// for simulated WiHome devices
+
+#include "WiHomeHost.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <malloc.h>
+
+static sockaddr_in host_sockaddr(IPAddress ip, unsigned int port)
+{
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(((uint32_t) ip[0] << 24) | ((uint32_t) ip[1] << 16) |
+                               ((uint32_t) ip[2] << 8) | (uint32_t) ip[3]);
+  return addr;
+}
+
+static IPAddress host_ipaddress(const sockaddr_in& addr)
+{
+  uint32_t ip = ntohl(addr.sin_addr.s_addr);
+  return IPAddress(ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
+}
+
+unsigned long WiHomeHostClock::ms()
+{
+  return us() / 1000;
+}
+
+unsigned long WiHomeHostClock::us()
+{
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long) t.tv_sec * 1000000UL + t.tv_nsec / 1000;
+}
+
+WiHomeHostTcpClient::WiHomeHostTcpClient(IPAddress _address)
+{
+  address = _address;
+}
+
+WiHomeHostTcpClient::~WiHomeHostTcpClient()
+{
+  stop();
+}
+
+int WiHomeHostTcpClient::connect(IPAddress ip, uint16_t port)
+{
+  stop();
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return 0;
+  sockaddr_in local = host_sockaddr(address, 0);
+  sockaddr_in remote = host_sockaddr(ip, port);
+  if (bind(fd, (sockaddr*) &local, sizeof(local)) < 0 ||
+      ::connect(fd, (sockaddr*) &remote, sizeof(remote)) < 0)
+  {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+int WiHomeHostTcpClient::connect(const char* host, uint16_t port)
+{
+  IPAddress ip;
+  if (!ip.fromString(host))
+    return 0;
+  return connect(ip, port);
+}
+
+size_t WiHomeHostTcpClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t WiHomeHostTcpClient::write(const uint8_t* buffer, size_t size)
+{
+  if (fd < 0)
+    return 0;
+  ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL);
+  return (sent > 0) ? sent : 0;
+}
+
+int WiHomeHostTcpClient::available()
+{
+  int length = 0;
+  if (fd < 0 || ioctl(fd, FIONREAD, &length) < 0)
+    return 0;
+  return length;
+}
+
+int WiHomeHostTcpClient::read()
+{
+  uint8_t c;
+  return (read(&c, 1) == 1) ? c : -1;
+}
+
+int WiHomeHostTcpClient::read(uint8_t* buffer, size_t size)
+{
+  if (fd < 0)
+    return -1;
+  ssize_t length = recv(fd, buffer, size, MSG_DONTWAIT);
+  return (length > 0) ? length : -1;
+}
+
+int WiHomeHostTcpClient::peek()
+{
+  uint8_t c;
+  if (fd < 0 || recv(fd, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 1)
+    return -1;
+  return c;
+}
+
+void WiHomeHostTcpClient::flush()
+{
+}
+
+void WiHomeHostTcpClient::stop()
+{
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+}
+
+uint8_t WiHomeHostTcpClient::connected()
+{
+  if (fd < 0)
+    return 0;
+  // Open until the peer closed and all data was read:
+  uint8_t c;
+  ssize_t length = recv(fd, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+  return (length > 0 || (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)));
+}
+
+WiHomeHostTcpClient::operator bool()
+{
+  return (fd >= 0);
+}
+
+WiHomeHostNetwork::WiHomeHostNetwork(IPAddress _address, IPAddress _hub) : tcp_client(_address)
+{
+  address = _address;
+  hub = _hub;
+}
+
+WiHomeHostNetwork::~WiHomeHostNetwork()
+{
+  stop_udp();
+  update_abort();
+}
+
+void WiHomeHostNetwork::attach(int _epoll_fd, unsigned int tag)
+{
+  epoll_fd = _epoll_fd;
+  epoll_tag = tag;
+}
+
+bool WiHomeHostNetwork::readable()
+{
+  char c;
+  return (fd >= 0) && (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0);
+}
+
+bool WiHomeHostNetwork::station_mode()
+{
+  return station;
+}
+
+bool WiHomeHostNetwork::softap_mode()
+{
+  return softap;
+}
+
+bool WiHomeHostNetwork::stop_softap()
+{
+  softap = false;
+  return true;
+}
+
+bool WiHomeHostNetwork::stop_station()
+{
+  station = false;
+  return true;
+}
+
+void WiHomeHostNetwork::start_station(const char* ssid, const char* password, const char* hostname)
+{
+  // The loopback "station" is connected immediately:
+  name = hostname;
+  station = true;
+}
+
+bool WiHomeHostNetwork::station_connected()
+{
+  return station;
+}
+
+IPAddress WiHomeHostNetwork::local_ip()
+{
+  return address;
+}
+
+IPAddress WiHomeHostNetwork::broadcast_ip()
+{
+  // No broadcast on loopback, findhub goes straight to the hub:
+  return hub;
+}
+
+String WiHomeHostNetwork::hostname()
+{
+  return String(name.c_str());
+}
+
+bool WiHomeHostNetwork::start_softap_station(const char* ssid_softap)
+{
+  // Nothing to bring up, the config web server answers on the loopback address:
+  softap = true;
+  return true;
+}
+
+bool WiHomeHostNetwork::stop_softap_station()
+{
+  bool was_running = softap;
+  softap = false;
+  return was_running;
+}
+
+IPAddress WiHomeHostNetwork::softap_ip()
+{
+  return address;
+}
+
+int32_t WiHomeHostNetwork::rssi()
+{
+  return link_rssi;
+}
+
+void WiHomeHostNetwork::bssid(uint8_t* target)
+{
+  memcpy(target, current_bssid, 6);
+}
+
+void WiHomeHostNetwork::roam_station(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel)
+{
+  // Reassociation is immediate and the link takes the signal of the new access point:
+  memcpy(current_bssid, bssid, 6);
+  for (const WiHomeScanResult& ap : access_points)
+    if (memcmp(ap.bssid, bssid, 6) == 0)
+      link_rssi = ap.rssi;
+  station = true;
+}
+
+void WiHomeHostNetwork::release_bssid()
+{
+  // Loopback reconnects are not bound to an access point
+}
+
+bool WiHomeHostNetwork::start_scan()
+{
+  scanning = true;
+  return true;
+}
+
+int WiHomeHostNetwork::scan_complete()
+{
+  if (!scanning)
+    return WIHOMENETWORK_SCAN_FAILED;
+  return access_points.size();
+}
+
+bool WiHomeHostNetwork::scan_result(int n, WiHomeScanResult* result)
+{
+  if (!scanning || n < 0 || n >= (int) access_points.size())
+    return false;
+  *result = access_points[n];
+  return true;
+}
+
+void WiHomeHostNetwork::scan_delete()
+{
+  scanning = false;
+}
+
+bool WiHomeHostNetwork::mdns_running()
+{
+  return false;
+}
+
+bool WiHomeHostNetwork::stop_mdns()
+{
+  return true;
+}
+
+bool WiHomeHostNetwork::start_mdns(const char* hostname)
+{
+  return true;
+}
+
+void WiHomeHostNetwork::start_ota(const char* hostname, const char* password, WiHomeOTA* ota)
+{
+}
+
+void WiHomeHostNetwork::handle_ota()
+{
+}
+
+Client* WiHomeHostNetwork::update_client()
+{
+  return &tcp_client;
+}
+
+bool WiHomeHostNetwork::update_begin(size_t size)
+{
+  update_abort();
+  if (!update_path.empty())
+  {
+    update_file = fopen(update_path.c_str(), "wb");
+    if (!update_file)
+      return false;
+  }
+  update_size = size;
+  update_written = 0;
+  return true;
+}
+
+size_t WiHomeHostNetwork::update_write(const uint8_t* data, size_t length)
+{
+  if (update_written + length > update_size)
+    return 0;
+  if (update_file && fwrite(data, 1, length, update_file) != length)
+    return 0;
+  update_written += length;
+  return length;
+}
+
+bool WiHomeHostNetwork::update_end()
+{
+  bool complete = (update_written == update_size);
+  if (update_file)
+    complete = (fclose(update_file) == 0) && complete;
+  update_file = NULL;
+  return complete;
+}
+
+void WiHomeHostNetwork::update_abort()
+{
+  if (update_file)
+  {
+    fclose(update_file);
+    remove(update_path.c_str());
+  }
+  update_file = NULL;
+}
+
+void WiHomeHostNetwork::restart()
+{
+  restarts++;
+}
+
+void WiHomeHostNetwork::enable_web_server(bool enable)
+{
+  web_server = enable;
+}
+
+bool WiHomeHostNetwork::has_web_server()
+{
+  return web_server;
+}
+
+bool WiHomeHostNetwork::begin_udp(unsigned int port)
+{
+  stop_udp();
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = host_sockaddr(address, port);
+  if (bind(fd, (sockaddr*) &addr, sizeof(addr)) < 0)
+  {
+    WHLOG_ERROR("[ERROR] Could not bind %s:%u (errno %d).\n", address.toString().c_str(), port, errno);
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  if (epoll_fd >= 0)
+  {
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = epoll_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+  return true;
+}
+
+void WiHomeHostNetwork::stop_udp()
+{
+  if (fd >= 0)
+  {
+    if (epoll_fd >= 0)
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    fd = -1;
+  }
+  rx_length = 0;
+  rx_position = 0;
+}
+
+int WiHomeHostNetwork::parse_packet()
+{
+  rx_length = 0;
+  rx_position = 0;
+  if (fd < 0)
+    return 0;
+  sockaddr_in from;
+  socklen_t from_length = sizeof(from);
+  ssize_t length = recvfrom(fd, rx_buffer, sizeof(rx_buffer), 0, (sockaddr*) &from, &from_length);
+  if (length <= 0)
+    return 0;
+  rx_length = length;
+  rx_remote = host_ipaddress(from);
+  packets_received++;
+  return rx_length;
+}
+
+int WiHomeHostNetwork::read(char* buffer, size_t size)
+{
+  int length = rx_length - rx_position;
+  if (length > (int) size)
+    length = size;
+  memcpy(buffer, &rx_buffer[rx_position], length);
+  rx_position += length;
+  return length;
+}
+
+IPAddress WiHomeHostNetwork::remote_ip()
+{
+  return rx_remote;
+}
+
+bool WiHomeHostNetwork::begin_packet(IPAddress ip, unsigned int port)
+{
+  tx_ip = ip;
+  tx_port = port;
+  tx_length = 0;
+  return (fd >= 0);
+}
+
+bool WiHomeHostNetwork::end_packet()
+{
+  if (fd < 0)
+    return false;
+  sockaddr_in addr = host_sockaddr(tx_ip, tx_port);
+  if (sendto(fd, tx_buffer, tx_length, 0, (sockaddr*) &addr, sizeof(addr)) != (ssize_t) tx_length)
+  {
+    send_errors++;
+    return false;
+  }
+  packets_sent++;
+  return true;
+}
+
+size_t WiHomeHostNetwork::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t WiHomeHostNetwork::write(const uint8_t* buffer, size_t size)
+{
+  if (tx_length + size > sizeof(tx_buffer))
+    size = sizeof(tx_buffer) - tx_length;
+  memcpy(&tx_buffer[tx_length], buffer, size);
+  tx_length += size;
+  return size;
+}
+
+WiHomeHostStorage::WiHomeHostStorage(const char* _filename)
+{
+  filename = _filename;
+  std::ifstream file(filename);
+  valid = file.good();
+  std::string line;
+  while (std::getline(file, line))
+  {
+    size_t n = line.find('=');
+    if (n != std::string::npos)
+      values[line.substr(0, n)] = line.substr(n + 1);
+  }
+}
+
+bool WiHomeHostStorage::is_valid_file()
+{
+  return valid;
+}
+
+void WiHomeHostStorage::get(const char* name, char* value)
+{
+  auto it = values.find(name);
+  if (it != values.end())
+  {
+    // Parameter strings of WiHomeComm have 32 bytes:
+    strncpy(value, it->second.c_str(), 31);
+    value[31] = 0;
+  }
+}
+
+void WiHomeHostStorage::get(const char* name, float* value)
+{
+  auto it = values.find(name);
+  if (it != values.end())
+    *value = atof(it->second.c_str());
+}
+
+void WiHomeHostStorage::get(const char* name, bool* value)
+{
+  auto it = values.find(name);
+  if (it != values.end())
+    *value = (atoi(it->second.c_str()) != 0);
+}
+
+void WiHomeHostStorage::set_nowrite(const char* name, const char* value)
+{
+  values[name] = value;
+}
+
+void WiHomeHostStorage::set_nowrite(const char* name, float value)
+{
+  char str[32];
+  snprintf(str, sizeof(str), "%.7f", value);
+  values[name] = str;
+}
+
+void WiHomeHostStorage::set_nowrite(const char* name, bool value)
+{
+  values[name] = value ? "1" : "0";
+}
+
+void WiHomeHostStorage::write()
+{
+  std::ofstream file(filename);
+  for (auto& value : values)
+    file << value.first << "=" << value.second << "\n";
+  valid = file.good();
+}
+
+void WiHomeHostStorage::dump()
+{
+#if WIHOMECOMM_LOG_LEVEL >= WHLOG_LEVEL_DEBUG
+  for (auto& value : values)
+    WHLOG_DEBUG("%s: %s\n", value.first.c_str(), value.second.c_str());
+#endif
+}
+
+static uint32_t host_free_heap()
+{
+  // Allocations of the process against a nominal heap size, so wihome_heap
+  // attributes real allocations to subsystems (the emulated ESP.getFreeHeap()
+  // is a constant):
+  size_t used = mallinfo2().uordblks;
+  return (used < WIHOMEHOST_HEAP_SIZE) ? WIHOMEHOST_HEAP_SIZE - used : 0;
+}
+
+WiHomeHostLoop::WiHomeHostLoop()
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wihome_heap.set_readers(host_free_heap, host_free_heap);
+}
+
+WiHomeHostLoop::~WiHomeHostLoop()
+{
+  for (auto& device : devices)
+  {
+    delete device.whc;
+    delete device.network;
+    delete device.storage;
+  }
+  close(epoll_fd);
+}
+
+WiHomeComm* WiHomeHostLoop::add_device(const char* client, const char* config_dir, IPAddress hub)
+{
+  unsigned int n = devices.size();
+  IPAddress address(127, 1 + n / 65536, (n / 256) % 256, n % 256);
+  std::string filename = std::string(config_dir) + "/" + client + ".cfg";
+  mkdir(config_dir, 0755);
+  WiHomeHostDevice device;
+  device.storage = new WiHomeHostStorage(filename.c_str());
+  if (!device.storage->is_valid_file())
+  {
+    // New device: store the settings WiHomeComm needs to connect
+    device.storage->set_nowrite("ssid", "wihome_host");
+    device.storage->set_nowrite("password", "");
+    device.storage->set_nowrite("client", client);
+    device.storage->set_nowrite("homekit_reset", false);
+    device.storage->write();
+  }
+  device.network = new WiHomeHostNetwork(address, hub);
+  device.network->attach(epoll_fd, n);
+  device.whc = new WiHomeComm(device.network, device.storage, &clock);
+  devices.push_back(device);
+  return device.whc;
+}
+
+unsigned int WiHomeHostLoop::size()
+{
+  return devices.size();
+}
+
+WiHomeHostDevice& WiHomeHostLoop::device(unsigned int n)
+{
+  return devices[n];
+}
+
+WiHomeClock* WiHomeHostLoop::get_clock()
+{
+  return &clock;
+}
+
+void WiHomeHostLoop::run(int timeout_ms)
+{
+  epoll_event events[64];
+  int N_events = epoll_wait(epoll_fd, events, 64, timeout_ms);
+  for (int n=0; n<N_events; n++)
+  {
+    WiHomeHostDevice& device = devices[events[n].data.u32];
+    // check() serves one packet per call:
+    for (int k=0; k<WIHOMEHOST_MAX_PACKETS_PER_WAKEUP && device.network->readable(); k++)
+      device.whc->check();
+  }
+  if (clock.ms() - t_tick >= WIHOMEHOST_TICK)
+  {
+    t_tick = clock.ms();
+    for (auto& device : devices)
+      device.whc->check();
+  }
+}
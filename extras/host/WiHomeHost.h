@@ -0,0 +1,187 @@
+// WiHome Host Backend
+//
+// Linux implementations of the WiHomeComm network, storage and clock interfaces.
+// Every WiHomeHostNetwork binds its own loopback address (127.x.y.z) on the
+// WiHome UDP port and sends findhub messages directly to the hub address, so
+// thousands of WiHomeComm objects can run in one process, driven by one
+// WiHomeHostLoop. There is no config portal, web server, mDNS or ArduinoOTA on the
+// host; firmware updates pulled over HTTP are written to a file.
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "WiHomeComm.h"
+
+#ifndef WIHOMEHOST_H
+#define WIHOMEHOST_H
+
+#define WIHOMEHOST_MAX_PACKET 1024
+#define WIHOMEHOST_TICK 10 //ms, interval for calling check() on all devices
+#define WIHOMEHOST_MAX_PACKETS_PER_WAKEUP 8
+#define WIHOMEHOST_HEAP_SIZE 0x40000000UL // Nominal heap size for wihome_heap
+
+class WiHomeHostClock : public WiHomeClock
+{
+  public:
+    unsigned long ms();
+    unsigned long us();
+};
+
+// TCP client on a POSIX socket, bound to the device address; connect() blocks,
+// reads do not
+class WiHomeHostTcpClient : public Client
+{
+  private:
+    IPAddress address;
+    int fd = -1;
+  public:
+    WiHomeHostTcpClient(IPAddress _address);
+    ~WiHomeHostTcpClient();
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char* host, uint16_t port); // Numeric addresses only
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    int available();
+    int read();
+    int read(uint8_t* buffer, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+};
+
+class WiHomeHostNetwork : public WiHomeNetwork
+{
+  private:
+    IPAddress address;
+    IPAddress hub;
+    std::string name;
+    bool station = false;
+    bool web_server = false;
+    bool softap = false; // Live config portal (AP+STA) running
+    uint8_t current_bssid[6] = {0};
+    bool scanning = false;
+    int fd = -1;
+    int epoll_fd = -1;
+    unsigned int epoll_tag = 0;
+    char rx_buffer[WIHOMEHOST_MAX_PACKET];
+    int rx_length = 0;
+    int rx_position = 0;
+    IPAddress rx_remote;
+    char tx_buffer[WIHOMEHOST_MAX_PACKET];
+    size_t tx_length = 0;
+    IPAddress tx_ip;
+    unsigned int tx_port = 0;
+    WiHomeHostTcpClient tcp_client;
+    FILE* update_file = NULL;
+    size_t update_size = 0;
+    size_t update_written = 0;
+  public:
+    WiHomeHostNetwork(IPAddress _address, IPAddress _hub);
+    ~WiHomeHostNetwork();
+    void attach(int _epoll_fd, unsigned int tag); // Register the UDP socket with an event loop
+    bool readable(); // A received packet is waiting
+    void enable_web_server(bool enable); // Web servers on port 80, for single device tests
+    unsigned long packets_sent = 0;
+    unsigned long packets_received = 0;
+    unsigned long send_errors = 0;
+    // Simulated radio environment for link quality and roaming tests:
+    int32_t link_rssi = -50;
+    std::vector<WiHomeScanResult> access_points;
+    // Firmware updates are written to update_path (if set):
+    std::string update_path;
+    unsigned long restarts = 0;
+    bool station_mode();
+    bool softap_mode();
+    bool stop_softap();
+    bool stop_station();
+    void start_station(const char* ssid, const char* password, const char* hostname);
+    bool station_connected();
+    IPAddress local_ip();
+    IPAddress broadcast_ip();
+    String hostname();
+    bool start_softap_station(const char* ssid_softap);
+    bool stop_softap_station();
+    IPAddress softap_ip();
+    int32_t rssi();
+    void bssid(uint8_t* target);
+    void roam_station(const char* ssid, const char* password, const uint8_t* bssid, int32_t channel);
+    void release_bssid();
+    bool start_scan();
+    int scan_complete();
+    bool scan_result(int n, WiHomeScanResult* result);
+    void scan_delete();
+    bool mdns_running();
+    bool stop_mdns();
+    bool start_mdns(const char* hostname);
+    void start_ota(const char* hostname, const char* password, WiHomeOTA* ota);
+    void handle_ota();
+    Client* update_client();
+    bool update_begin(size_t size);
+    size_t update_write(const uint8_t* data, size_t length);
+    bool update_end();
+    void update_abort();
+    void restart();
+    bool has_web_server();
+    bool begin_udp(unsigned int port);
+    void stop_udp();
+    int parse_packet();
+    int read(char* buffer, size_t size);
+    IPAddress remote_ip();
+    bool begin_packet(IPAddress ip, unsigned int port);
+    bool end_packet();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+};
+
+// Config parameters as name=value lines in a text file
+class WiHomeHostStorage : public WiHomeStorage
+{
+  private:
+    std::string filename;
+    std::map<std::string, std::string> values;
+    bool valid = false;
+  public:
+    WiHomeHostStorage(const char* _filename);
+    bool is_valid_file();
+    void get(const char* name, char* value);
+    void get(const char* name, float* value);
+    void get(const char* name, bool* value);
+    void set_nowrite(const char* name, const char* value);
+    void set_nowrite(const char* name, float value);
+    void set_nowrite(const char* name, bool value);
+    void write();
+    void dump();
+};
+
+// One simulated device: WiHomeComm with its own network and storage
+struct WiHomeHostDevice
+{
+  WiHomeHostNetwork* network;
+  WiHomeHostStorage* storage;
+  WiHomeComm* whc;
+};
+
+class WiHomeHostLoop
+{
+  private:
+    int epoll_fd;
+    WiHomeHostClock clock;
+    std::vector<WiHomeHostDevice> devices;
+    unsigned long t_tick = 0;
+  public:
+    WiHomeHostLoop();
+    ~WiHomeHostLoop();
+    // Creates a device on loopback address 127.(1+n/65536).(n/256).(n%256) with config file
+    // <config_dir>/<client>.cfg; the hub is expected at hub:24557:
+    WiHomeComm* add_device(const char* client, const char* config_dir, IPAddress hub);
+    unsigned int size();
+    WiHomeHostDevice& device(unsigned int n);
+    WiHomeClock* get_clock();
+    // Waits up to timeout_ms for packets, serves them and calls check() on all
+    // devices every WIHOMEHOST_TICK ms:
+    void run(int timeout_ms);
+};
+
+#endif // WIHOMEHOST_H
@@ -0,0 +1,63 @@
+// Simulated fleet of WiHome devices on the Linux host backend
+//
+// Usage: wihome_fleet [devices] [messages/s per device] [seconds] [hub ip] [config dir]
+
+#include "WiHomeHost.h"
+
+int main(int argc, char* argv[])
+{
+  unsigned int N_devices = (argc > 1) ? atoi(argv[1]) : 2000;
+  float rate = (argc > 2) ? atof(argv[2]) : 1.0;
+  unsigned long duration = (argc > 3) ? atol(argv[3]) : 60;
+  IPAddress hub(127, 0, 0, 1);
+  if (argc > 4)
+    hub.fromString(argv[4]);
+  const char* config_dir = (argc > 5) ? argv[5] : "wihome_fleet";
+
+  WiHomeHostLoop loop;
+  char client[32];
+  for (unsigned int n=0; n<N_devices; n++)
+  {
+    snprintf(client, sizeof(client), "sim%05u", n);
+    loop.add_device(client, config_dir, hub);
+  }
+  printf("%u devices created, sending %.2f messages/s each for %lu s.\n", N_devices, rate, duration);
+
+  WiHomeClock* clock = loop.get_clock();
+  unsigned long t_start = clock->ms();
+  unsigned long t_report = t_start;
+  unsigned long interval = (rate > 0) ? (unsigned long) (1000 / rate) : 0;
+  std::vector<unsigned long> t_send(N_devices, 0);
+  std::vector<unsigned long> seq(N_devices, 0);
+  // Spread the first messages evenly over one interval:
+  for (unsigned int n=0; n<N_devices; n++)
+    t_send[n] = t_start + (interval * n) / (N_devices ? N_devices : 1);
+  while (clock->ms() - t_start < duration * 1000)
+  {
+    loop.run(1);
+    unsigned long t = clock->ms();
+    if (interval)
+      for (unsigned int n=0; n<N_devices; n++)
+        if ((long) (t - t_send[n]) >= 0)
+        {
+          loop.device(n).whc->sendJSON("seq", seq[n]++, "value", (float) (n % 100));
+          t_send[n] += interval;
+        }
+    if (t - t_report >= 1000)
+    {
+      unsigned long sent = 0, received = 0, errors = 0, connected = 0;
+      for (unsigned int n=0; n<N_devices; n++)
+      {
+        sent += loop.device(n).network->packets_sent;
+        received += loop.device(n).network->packets_received;
+        errors += loop.device(n).network->send_errors;
+        if (loop.device(n).whc->status() == WIHOMECOMM_CONNECTED)
+          connected++;
+      }
+      printf("t=%lus sent=%lu received=%lu errors=%lu hub_connected=%lu/%u\n",
+             (t - t_start) / 1000, sent, received, errors, connected, N_devices);
+      t_report = t;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+// Firmware pull test of the Linux host backend against a local stand-in HTTP server
+//
+// Serves a random image with Range support from a thread and closes every
+// connection after a fixed number of body bytes, so the device has to resume the
+// download several times. Passes if the image written by the device matches and
+// the device restarted exactly once.
+//
+// Usage: wihome_ota_pull [image size in bytes] [bytes per connection]
+
+#include "WiHomeHost.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+static std::vector<uint8_t> image;
+static size_t bytes_per_connection;
+static std::atomic<unsigned int> N_connections(0);
+
+static void serve(int listen_fd)
+{
+  while (true)
+  {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      return;
+    N_connections++;
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos)
+    {
+      ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+      if (length <= 0)
+        break;
+      request.append(buffer, length);
+    }
+    size_t start = 0;
+    size_t range = request.find("Range: bytes=");
+    if (range != std::string::npos)
+      start = strtoul(request.c_str() + range + 13, NULL, 10);
+    int length;
+    if (range != std::string::npos)
+      length = snprintf(buffer, sizeof(buffer), "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\n"
+                        "Content-Range: bytes %zu-%zu/%zu\r\nConnection: close\r\n\r\n",
+                        image.size() - start, start, image.size() - 1, image.size());
+    else
+      length = snprintf(buffer, sizeof(buffer), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n"
+                        "Content-Type: application/octet-stream\r\nConnection: close\r\n\r\n", image.size());
+    send(fd, buffer, length, MSG_NOSIGNAL);
+    size_t end = std::min(image.size(), start + bytes_per_connection);
+    if (start < end)
+      send(fd, &image[start], end - start, MSG_NOSIGNAL);
+    close(fd);
+  }
+}
+
+static bool wait_connected(WiHomeComm* whc)
+{
+  for (int n=0; n<1000; n++)
+  {
+    whc->check();
+    if (whc->status() == WIHOMECOMM_NOHUB || whc->status() == WIHOMECOMM_CONNECTED)
+      return true;
+  }
+  return false;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t size = (argc > 1) ? atol(argv[1]) : 400000;
+  bytes_per_connection = (argc > 2) ? atol(argv[2]) : 100000;
+  srand(1);
+  image.resize(size);
+  for (size_t n=0; n<size; n++)
+    image[n] = rand();
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_length = sizeof(addr);
+  if (bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0 ||
+      getsockname(listen_fd, (sockaddr*) &addr, &addr_length) < 0)
+  {
+    printf("FAILED: could not start HTTP server.\n");
+    return 1;
+  }
+  std::thread server(serve, listen_fd);
+  server.detach();
+
+  WiHomeHostLoop loop;
+  WiHomeComm* whc = loop.add_device("ota", "wihome_ota_pull", IPAddress(127, 0, 0, 1));
+  WiHomeHostNetwork* network = loop.device(0).network;
+  network->update_path = "wihome_ota_pull/update.bin";
+  if (!wait_connected(whc))
+  {
+    printf("FAILED: device did not connect.\n");
+    return 1;
+  }
+
+  char url[64];
+  snprintf(url, sizeof(url), "http://127.0.0.1:%u/firmware.bin.gz", ntohs(addr.sin_port));
+  if (!whc->update_from(url))
+  {
+    printf("FAILED: update not started.\n");
+    return 1;
+  }
+  unsigned long t_start = loop.get_clock()->ms();
+  while (whc->update_in_progress() && loop.get_clock()->ms() - t_start < 60000)
+    whc->check();
+  wait_connected(whc);
+  unsigned long throughput = whc->get_update_throughput();
+  wihome_log.flush();
+
+  std::ifstream file(network->update_path, std::ios::binary);
+  std::vector<uint8_t> written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  printf("%zu bytes over %u connections, %lu bytes/s, %lu restarts\n",
+         written.size(), N_connections.load(), throughput, network->restarts);
+  if (written != image || network->restarts != 1)
+  {
+    printf("FAILED: image %s, %lu restarts.\n", (written == image) ? "matches" : "differs", network->restarts);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
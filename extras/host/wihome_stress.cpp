@@ -0,0 +1,98 @@
+// Heap stress test of mode changes on the Linux host backend
+//
+// Cycles one device thousands of times between station mode, the AP+STA config
+// portal and full reconnects, also while the config portal runs, and fails if the
+// heap in use keeps growing.
+//
+// Usage: wihome_stress [cycles] [allowed growth in bytes]
+
+#include "WiHomeHost.h"
+#include <malloc.h>
+
+static size_t heap_in_use()
+{
+  return mallinfo2().uordblks;
+}
+
+static bool wait_connected(WiHomeComm* whc)
+{
+  for (int n=0; n<1000; n++)
+  {
+    whc->check();
+    if (whc->status() == WIHOMECOMM_NOHUB || whc->status() == WIHOMECOMM_CONNECTED)
+      return true;
+  }
+  return false;
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned long cycles = (argc > 1) ? atol(argv[1]) : 10000;
+  long allowed_growth = (argc > 2) ? atol(argv[2]) : 1024;
+  unsigned long warmup = cycles / 10;
+
+  WiHomeHostLoop loop;
+  WiHomeComm* whc = loop.add_device("stress", "wihome_stress", IPAddress(127, 0, 0, 1));
+  loop.device(0).network->enable_web_server(true);
+  if (!wait_connected(whc))
+  {
+    printf("FAILED: device did not connect.\n");
+    return 1;
+  }
+
+  size_t baseline = 0;
+  for (unsigned long n=0; n<cycles; n++)
+  {
+    // Config portal next to the station and back:
+    whc->softAPmode = true;
+    for (int k=0; k<5; k++)
+      whc->check();
+    if (n % 3 == 2)
+    {
+      // Reconnect while the config portal runs: the live portal has to end (the
+      // stand-alone soft AP portal, which follows on the ESP8266, is not modelled
+      // by the host network, so status() no longer reports the soft AP):
+      whc->reconnect();
+      for (int k=0; k<5; k++)
+        whc->check();
+      if (whc->status() == WIHOMECOMM_SOFTAP)
+      {
+        printf("FAILED: live config still running after a reconnect in cycle %lu.\n", n);
+        return 1;
+      }
+    }
+    whc->softAPmode = false;
+    for (int k=0; k<5; k++)
+      whc->check();
+    if (!wait_connected(whc))
+    {
+      printf("FAILED: station not restored in cycle %lu.\n", n);
+      return 1;
+    }
+    // Full reconnect through the state machine (UDP, timers, main web server):
+    if (n % 2)
+    {
+      whc->reconnect();
+      if (!wait_connected(whc))
+      {
+        printf("FAILED: no reconnect in cycle %lu.\n", n);
+        return 1;
+      }
+    }
+    wihome_log.flush();
+    if (n == warmup)
+      baseline = heap_in_use();
+  }
+
+  long growth = (long) heap_in_use() - (long) baseline;
+  char heap[512];
+  wihome_heap.format_json(heap, sizeof(heap));
+  printf("%lu cycles, heap growth after warmup: %ld bytes\n%s\n", cycles, growth, heap);
+  if (growth > allowed_growth)
+  {
+    printf("FAILED: heap grows by more than %ld bytes.\n", allowed_growth);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Hub clock synchronization test of WiHomeSync on a simulated clock
+//
+// Runs findhub/hubid exchanges against a simulated hub clock and checks the
+// estimate for a constant offset, a drifting hub clock, asymmetric path delays
+// (which NTP-style estimation cannot see; the offset is off by half the
+// asymmetry) and that exchanges delayed in a queue are rejected. The local
+// microsecond counter starts just below its 32 bit wrap.
+//
+// Usage: wihome_sync
+
+#include "WiHomeSync.h"
+#include <math.h>
+#include <stdlib.h>
+
+static uint64_t sim_us = 0; // Simulated local time
+
+class WiHomeSimClock : public WiHomeClock
+{
+  public:
+    unsigned long ms() { return sim_us / 1000; }
+    unsigned long us() { return (uint32_t) sim_us; }
+};
+
+struct HubModel
+{
+  int64_t offset; // us, hub minus local time at local time 0
+  double drift; // ppm
+  uint64_t time(uint64_t local) { return local + offset + (int64_t) (drift * 1e-6 * (double) local); }
+};
+
+// One findhub/hubid exchange with the given one-way delays, hub processing takes 100 us:
+static bool exchange(WiHomeSync& sync, HubModel& hub, uint64_t uplink, uint64_t downlink)
+{
+  uint64_t t1 = sync.request();
+  uint64_t at_hub = sim_us + uplink;
+  uint64_t t2 = hub.time(at_hub);
+  uint64_t t3 = hub.time(at_hub + 100);
+  sim_us = at_hub + 100 + downlink;
+  return sync.response(t1, t2, t3, sync.local_us());
+}
+
+// Error of the current hub time estimate in us:
+static int64_t error(WiHomeSync& sync, HubModel& hub)
+{
+  uint64_t local = sync.local_us();
+  return (int64_t) (sync.to_hub(local) - hub.time(sim_us));
+}
+
+static void advance(WiHomeSync& sync, uint64_t us)
+{
+  // Steps below the wrap period, like the findhub heartbeat:
+  while (us > 0)
+  {
+    uint64_t step = (us > 60000000) ? 60000000 : us;
+    sim_us += step;
+    sync.local_us();
+    us -= step;
+  }
+}
+
+// Fast initial exchanges every 2 s, then n exchanges every 60 s:
+static void run(WiHomeSync& sync, HubModel& hub, unsigned int n, uint64_t uplink, uint64_t downlink)
+{
+  for (unsigned int k=0; k<WIHOMESYNC_MIN_SAMPLES+n; k++)
+  {
+    advance(sync, (k < WIHOMESYNC_MIN_SAMPLES) ? 2000000 : 60000000);
+    exchange(sync, hub, uplink, downlink);
+  }
+}
+
+static bool check(const char* test, bool passed, int64_t err, WiHomeSync& sync)
+{
+  printf("%s %s: error %lld us, drift %.2f ppm, round trip %lu us, samples %lu, rejected %lu\n",
+         passed ? "PASS" : "FAIL", test, (long long) err, sync.get_drift(),
+         (unsigned long) sync.round_trip, sync.samples, sync.rejected);
+  return passed;
+}
+
+static void start(WiHomeSync& sync, WiHomeSimClock& clock)
+{
+  sim_us = 0xffffffffULL - 5000000; // 5 s before the 32 bit counter wraps
+  sync.begin(&clock);
+  sync.reset();
+  sync.local_us();
+}
+
+int main()
+{
+  WiHomeSimClock clock;
+  bool passed = true;
+
+  // Constant offset, symmetric 1 ms paths:
+  {
+    WiHomeSync sync;
+    start(sync, clock);
+    HubModel hub = {1700000000000000LL, 0};
+    run(sync, hub, 20, 1000, 1000);
+    int64_t err = error(sync, hub);
+    passed &= check("constant offset", sync.synchronized() && llabs(err) <= 20
+                    && fabs(sync.get_drift()) < 1 && sync.round_trip == 2000, err, sync);
+  }
+
+  // Hub clock running 40 ppm fast, tracked over two hours:
+  {
+    WiHomeSync sync;
+    start(sync, clock);
+    HubModel hub = {-123456789LL, 40};
+    run(sync, hub, 120, 1500, 1500);
+    int64_t err = error(sync, hub);
+    bool ok = llabs(err) <= 100 && fabs(sync.get_drift() - 40) < 2;
+    // The drift estimate has to carry the time between exchanges:
+    advance(sync, 60000000);
+    int64_t err_later = error(sync, hub);
+    passed &= check("drift", ok && llabs(err_later) <= 200, err_later, sync);
+  }
+
+  // Asymmetric paths, 3 ms up and 1 ms down: the estimate is 1 ms ahead
+  {
+    WiHomeSync sync;
+    start(sync, clock);
+    HubModel hub = {5000000LL, 0};
+    run(sync, hub, 20, 3000, 1000);
+    int64_t err = error(sync, hub);
+    passed &= check("asymmetric delay", llabs(err - 1000) <= 20 && sync.round_trip == 4000, err, sync);
+  }
+
+  // Exchanges queued for 50 ms are rejected and leave the estimate alone:
+  {
+    WiHomeSync sync;
+    start(sync, clock);
+    HubModel hub = {42000000LL, 0};
+    run(sync, hub, 10, 1000, 1000);
+    int64_t err_before = error(sync, hub);
+    unsigned long samples = sync.samples;
+    bool accepted = false;
+    for (int k=0; k<5; k++)
+    {
+      advance(sync, 60000000);
+      accepted |= exchange(sync, hub, 51000, 1000);
+    }
+    int64_t err = error(sync, hub);
+    passed &= check("queued samples", !accepted && sync.rejected == 5 && sync.samples == samples
+                    && llabs(err - err_before) <= 20, err, sync);
+    // An answer without an outstanding request is ignored, as are repeats:
+    uint64_t t1 = sync.request();
+    uint64_t t4 = sync.local_us() + 2000;
+    bool first = sync.response(t1, hub.time(t1 + 1000), hub.time(t1 + 1100), t4);
+    bool repeat = sync.response(t1, hub.time(t1 + 1000), hub.time(t1 + 1100), t4);
+    passed &= check("duplicate answer", first && !repeat, error(sync, hub), sync);
+  }
+
+  printf(passed ? "OK\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,402 @@
+// Reference WiHome hub for benchmarks and protocol tests
+//
+// Answers findhub with hubid (including the time stamps devices synchronize
+// their clocks with), optionally probes known clients with findclient, tracks
+// clients by name and ingests their messages. Reports messages per second,
+// ingest latency (kernel receive timestamp to processing), findclient/clientid
+// round trip percentiles and, for time stamped messages, one-way latency from
+// the device and gaps in the message sequence.
+//
+// Build: g++ -O2 -std=c++11 -o wihome_hub wihome_hub.cpp
+// Usage: wihome_hub [-b bind_ip] [-p port] [-d device_port] [-P probe_interval_s] [-r report_interval_s]
+
+#include "wihome_protocol.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#define HUB_BATCH 64
+
+struct HubClient
+{
+  sockaddr_in addr;
+  uint64_t messages = 0;
+  uint64_t last_seen = 0; // ns
+  uint64_t probe_sent = 0; // ns, 0 if no probe pending
+  uint64_t last_seq = 0; // Sequence number of the last stamped message
+  bool seq_restart = false; // findhub seen, a lower sequence number means a reboot
+};
+
+struct HubStats
+{
+  uint64_t findhub = 0;
+  uint64_t clientid = 0;
+  uint64_t telemetry = 0;
+  uint64_t invalid = 0;
+  uint64_t sent = 0;
+  uint64_t send_errors = 0;
+  uint64_t seq_gaps = 0; // Stamped messages missing in the sequence
+  uint64_t seq_reordered = 0;
+  uint64_t clock_behind = 0; // Stamped messages received before their time stamp
+  void add(const HubStats& s)
+  {
+    seq_gaps += s.seq_gaps;
+    seq_reordered += s.seq_reordered;
+    clock_behind += s.clock_behind;
+    findhub += s.findhub;
+    clientid += s.clientid;
+    telemetry += s.telemetry;
+    invalid += s.invalid;
+    sent += s.sent;
+    send_errors += s.send_errors;
+  }
+};
+
+class WiHomeHub
+{
+  private:
+    int fd;
+    unsigned int device_port;
+    std::unordered_map<std::string, HubClient> clients;
+    HubStats interval_stats;
+    HubStats total_stats;
+    WiHomeLatency ingest_latency;
+    WiHomeLatency probe_latency;
+    WiHomeLatency oneway_latency;
+    // Replies are collected and sent with one sendmmsg() per batch:
+    mmsghdr tx_msgs[HUB_BATCH];
+    iovec tx_iovs[HUB_BATCH];
+    sockaddr_in tx_addrs[HUB_BATCH];
+    char tx_buffers[HUB_BATCH][WIHOME_MAX_PACKET];
+    unsigned int N_tx = 0;
+    void queue(const sockaddr_in& addr, const char* message);
+    void flush();
+    void handle(const char* packet, size_t length, const sockaddr_in& from, uint64_t rx_ns, uint64_t latency);
+    void stamped(HubClient& c, const char* packet, size_t length, uint64_t rx_ns);
+  public:
+    WiHomeHub(int _fd, unsigned int _device_port) : fd(_fd), device_port(_device_port) {}
+    void receive();
+    void probe(uint64_t interval);
+    void report(double seconds);
+    void summary(double seconds);
+};
+
+void WiHomeHub::queue(const sockaddr_in& addr, const char* message)
+{
+  if (N_tx == HUB_BATCH)
+    flush();
+  size_t length = strlen(message);
+  memcpy(tx_buffers[N_tx], message, length);
+  tx_addrs[N_tx] = addr;
+  tx_iovs[N_tx].iov_base = tx_buffers[N_tx];
+  tx_iovs[N_tx].iov_len = length;
+  memset(&tx_msgs[N_tx], 0, sizeof(mmsghdr));
+  tx_msgs[N_tx].msg_hdr.msg_name = &tx_addrs[N_tx];
+  tx_msgs[N_tx].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  tx_msgs[N_tx].msg_hdr.msg_iov = &tx_iovs[N_tx];
+  tx_msgs[N_tx].msg_hdr.msg_iovlen = 1;
+  N_tx++;
+}
+
+void WiHomeHub::flush()
+{
+  unsigned int n = 0;
+  while (n < N_tx)
+  {
+    int sent = sendmmsg(fd, &tx_msgs[n], N_tx - n, 0);
+    if (sent <= 0)
+    {
+      interval_stats.send_errors += N_tx - n;
+      break;
+    }
+    interval_stats.sent += sent;
+    n += sent;
+  }
+  N_tx = 0;
+}
+
+void WiHomeHub::stamped(HubClient& c, const char* packet, size_t length, uint64_t rx_ns)
+{
+  uint64_t seq, ts;
+  if (wihome_json_uint64(packet, length, "_seq", seq))
+  {
+    // The sequence starts over at 1 after a reboot, which also sends findhub first:
+    if (seq == 1 || (c.seq_restart && seq <= c.last_seq))
+      c.last_seq = 0;
+    c.seq_restart = false;
+    if (c.last_seq && seq > c.last_seq + 1)
+      interval_stats.seq_gaps += seq - c.last_seq - 1;
+    else if (c.last_seq && seq <= c.last_seq)
+      interval_stats.seq_reordered++;
+    if (seq > c.last_seq)
+      c.last_seq = seq;
+  }
+  if (wihome_json_uint64(packet, length, "_ts", ts))
+  {
+    uint64_t rx_us = rx_ns / 1000;
+    if (rx_us >= ts)
+      oneway_latency.add((rx_us - ts) * 1000);
+    else
+      interval_stats.clock_behind++;
+  }
+}
+
+void WiHomeHub::handle(const char* packet, size_t length, const sockaddr_in& from, uint64_t rx_ns, uint64_t latency)
+{
+  std::string client;
+  if (!wihome_json_string(packet, length, "client", client))
+  {
+    interval_stats.invalid++;
+    return;
+  }
+  ingest_latency.add(latency);
+  uint64_t now = wihome_now_ns();
+  HubClient& c = clients[client];
+  // Devices listen on the WiHome port, not on the source port:
+  c.addr = from;
+  c.addr.sin_port = htons(device_port);
+  c.messages++;
+  c.last_seen = now;
+  std::string cmd;
+  if (!wihome_json_string(packet, length, "cmd", cmd))
+  {
+    interval_stats.telemetry++;
+    stamped(c, packet, length, rx_ns);
+  }
+  else if (cmd == "findhub")
+  {
+    interval_stats.findhub++;
+    c.seq_restart = true;
+    uint64_t t1;
+    if (wihome_json_uint64(packet, length, "t1", t1))
+    {
+      // NTP-style time stamps: t2 is the kernel receive time, t3 is taken when the
+      // reply is queued (sendmmsg follows within the same batch):
+      char message[WIHOME_MAX_PACKET];
+      snprintf(message, sizeof(message), "{\"cmd\":\"hubid\",\"t1\":%llu,\"t2\":%llu,\"t3\":%llu}",
+               (unsigned long long) t1, (unsigned long long) (rx_ns / 1000),
+               (unsigned long long) wihome_realtime_us());
+      queue(c.addr, message);
+    }
+    else
+      queue(c.addr, "{\"cmd\":\"hubid\"}");
+  }
+  else if (cmd == "clientid")
+  {
+    interval_stats.clientid++;
+    if (c.probe_sent)
+    {
+      probe_latency.add(now - c.probe_sent);
+      c.probe_sent = 0;
+    }
+  }
+  else
+  {
+    interval_stats.telemetry++;
+    stamped(c, packet, length, rx_ns);
+  }
+}
+
+void WiHomeHub::receive()
+{
+  mmsghdr msgs[HUB_BATCH];
+  iovec iovs[HUB_BATCH];
+  sockaddr_in addrs[HUB_BATCH];
+  static char buffers[HUB_BATCH][WIHOME_MAX_PACKET];
+  char controls[HUB_BATCH][CMSG_SPACE(sizeof(timespec))];
+  while (true)
+  {
+    memset(msgs, 0, sizeof(msgs));
+    for (int n=0; n<HUB_BATCH; n++)
+    {
+      iovs[n].iov_base = buffers[n];
+      iovs[n].iov_len = WIHOME_MAX_PACKET;
+      msgs[n].msg_hdr.msg_name = &addrs[n];
+      msgs[n].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      msgs[n].msg_hdr.msg_iov = &iovs[n];
+      msgs[n].msg_hdr.msg_iovlen = 1;
+      msgs[n].msg_hdr.msg_control = controls[n];
+      msgs[n].msg_hdr.msg_controllen = sizeof(controls[n]);
+    }
+    int N_msgs = recvmmsg(fd, msgs, HUB_BATCH, MSG_DONTWAIT, NULL);
+    if (N_msgs <= 0)
+      break;
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t now_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    for (int n=0; n<N_msgs; n++)
+    {
+      uint64_t latency = 0;
+      uint64_t rx_ns = now_ns;
+      for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[n].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[n].msg_hdr, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+          timespec ts;
+          memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+          uint64_t ts_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+          latency = (now_ns > ts_ns) ? now_ns - ts_ns : 0;
+          rx_ns = ts_ns;
+        }
+      handle(buffers[n], msgs[n].msg_len, addrs[n], rx_ns, latency);
+    }
+    flush();
+    if (N_msgs < HUB_BATCH)
+      break;
+  }
+}
+
+void WiHomeHub::probe(uint64_t interval)
+{
+  uint64_t now = wihome_now_ns();
+  char message[WIHOME_MAX_PACKET];
+  for (auto& client : clients)
+    if (!client.second.probe_sent || now - client.second.probe_sent >= interval)
+    {
+      snprintf(message, sizeof(message), "{\"cmd\":\"findclient\",\"client\":\"%s\"}", client.first.c_str());
+      queue(client.second.addr, message);
+      client.second.probe_sent = now;
+    }
+  flush();
+}
+
+void WiHomeHub::report(double seconds)
+{
+  uint64_t received = interval_stats.findhub + interval_stats.clientid + interval_stats.telemetry + interval_stats.invalid;
+  printf("msg/s=%.0f (findhub=%llu clientid=%llu telemetry=%llu invalid=%llu) sent=%llu errors=%llu clients=%zu"
+         " ingest_us p50=%.1f p90=%.1f p99=%.1f max=%.1f probe_rtt_us p50=%.1f p99=%.1f n=%zu"
+         " oneway_us p50=%.1f p99=%.1f n=%zu seq_gaps=%llu reordered=%llu clock_behind=%llu\n",
+         received / seconds, (unsigned long long) interval_stats.findhub,
+         (unsigned long long) interval_stats.clientid, (unsigned long long) interval_stats.telemetry,
+         (unsigned long long) interval_stats.invalid, (unsigned long long) interval_stats.sent,
+         (unsigned long long) interval_stats.send_errors, clients.size(),
+         ingest_latency.percentile_us(50), ingest_latency.percentile_us(90),
+         ingest_latency.percentile_us(99), ingest_latency.max_us(),
+         probe_latency.percentile_us(50), probe_latency.percentile_us(99), probe_latency.size(),
+         oneway_latency.percentile_us(50), oneway_latency.percentile_us(99), oneway_latency.size(),
+         (unsigned long long) interval_stats.seq_gaps, (unsigned long long) interval_stats.seq_reordered,
+         (unsigned long long) interval_stats.clock_behind);
+  fflush(stdout);
+  total_stats.add(interval_stats);
+  interval_stats = HubStats();
+  ingest_latency.clear();
+  probe_latency.clear();
+  oneway_latency.clear();
+}
+
+void WiHomeHub::summary(double seconds)
+{
+  total_stats.add(interval_stats);
+  uint64_t received = total_stats.findhub + total_stats.clientid + total_stats.telemetry + total_stats.invalid;
+  printf("total: received=%llu (%.0f msg/s) telemetry=%llu sent=%llu errors=%llu clients=%zu seq_gaps=%llu\n",
+         (unsigned long long) received, received / seconds, (unsigned long long) total_stats.telemetry,
+         (unsigned long long) total_stats.sent, (unsigned long long) total_stats.send_errors, clients.size(),
+         (unsigned long long) total_stats.seq_gaps);
+}
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int)
+{
+  running = 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* bind_ip = "0.0.0.0";
+  unsigned int port = WIHOME_UDP_PORT;
+  unsigned int device_port = WIHOME_UDP_PORT;
+  double probe_interval = 0;
+  double report_interval = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:p:d:P:r:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': bind_ip = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 'd': device_port = atoi(optarg); break;
+      case 'P': probe_interval = atof(optarg); break;
+      case 'r': report_interval = atof(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-b bind_ip] [-p port] [-d device_port] [-P probe_interval_s] [-r report_interval_s]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  int buffer_size = 8 << 20;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+  sockaddr_in addr = wihome_sockaddr(bind_ip, port);
+  if (bind(fd, (sockaddr*) &addr, sizeof(addr)) < 0)
+  {
+    fprintf(stderr, "Could not bind %s:%u: %s\n", bind_ip, port, strerror(errno));
+    return 1;
+  }
+
+  // Timer for reports and probes:
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  itimerspec tick;
+  tick.it_interval.tv_sec = 0;
+  tick.it_interval.tv_nsec = 100000000; // 100 ms
+  tick.it_value = tick.it_interval;
+  timerfd_settime(timer_fd, 0, &tick, NULL);
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  event.data.fd = timer_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  printf("WiHome hub listening on %s:%u\n", bind_ip, port);
+  fflush(stdout);
+
+  WiHomeHub* hub = new WiHomeHub(fd, device_port);
+  uint64_t t_start = wihome_now_ns();
+  uint64_t t_report = t_start;
+  uint64_t t_probe = t_start;
+  while (running)
+  {
+    epoll_event events[2];
+    int N_events = epoll_wait(epoll_fd, events, 2, 1000);
+    for (int n=0; n<N_events; n++)
+    {
+      if (events[n].data.fd == fd)
+        hub->receive();
+      else
+      {
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+          continue;
+        uint64_t now = wihome_now_ns();
+        if (probe_interval > 0 && now - t_probe >= probe_interval * 1e9)
+        {
+          hub->probe(probe_interval * 1e9);
+          t_probe = now;
+        }
+        if (now - t_report >= report_interval * 1e9)
+        {
+          hub->report((now - t_report) / 1e9);
+          t_report = now;
+        }
+      }
+    }
+  }
+  hub->summary((wihome_now_ns() - t_start) / 1e9);
+  delete hub;
+  return 0;
+}
@@ -0,0 +1,195 @@
+// Load generator emulating a fleet of WiHome devices
+//
+// Every simulated device binds its own loopback address (127.1.x.y) on the
+// WiHome port and sends exactly the packets WiHomeComm sends: findhub on start
+// and every 60 s, clientid in reply to findclient, and telemetry as produced by
+// sendJSON("seq", n, "value", v) once the hub answered with hubid. With -T the
+// telemetry carries "_seq" and "_ts" like with stamp_messages, the time taken from
+// the host clock (the same clock as the hub's when both run on one machine).
+// Reports messages per second and findhub/hubid round trip percentiles.
+//
+// Build: g++ -O2 -std=c++11 -o wihome_loadgen wihome_loadgen.cpp
+// Usage: wihome_loadgen [-n devices] [-R messages/s per device] [-t seconds] [-h hub_ip] [-p port] [-T]
+
+#include "wihome_protocol.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LOADGEN_FINDHUB_INTERVAL 60000000000ULL // ns, WIHOMECOMM_FINDHUB_INTERVAL
+
+struct LoadgenDevice
+{
+  int fd;
+  char client[32];
+  bool hub_found = false;
+  sockaddr_in hub;
+  uint64_t findhub_sent = 0; // ns
+  uint64_t next_send = 0; // ns
+  unsigned long seq = 0;
+};
+
+int main(int argc, char* argv[])
+{
+  unsigned int N_devices = 2000;
+  double rate = 1;
+  double duration = 60;
+  const char* hub_ip = "127.0.0.1";
+  unsigned int port = WIHOME_UDP_PORT;
+  bool stamp = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:R:t:h:p:T")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': N_devices = atoi(optarg); break;
+      case 'R': rate = atof(optarg); break;
+      case 't': duration = atof(optarg); break;
+      case 'h': hub_ip = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 'T': stamp = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n devices] [-R messages/s per device] [-t seconds] [-h hub_ip] [-p port] [-T]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  // One socket per device:
+  rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<LoadgenDevice> devices(N_devices);
+  sockaddr_in hub = wihome_sockaddr(hub_ip, port);
+  uint64_t t_start = wihome_now_ns();
+  uint64_t interval = (rate > 0) ? (uint64_t) (1e9 / rate) : 0;
+  for (unsigned int n=0; n<N_devices; n++)
+  {
+    LoadgenDevice& d = devices[n];
+    snprintf(d.client, sizeof(d.client), "sim%05u", n);
+    char ip[20];
+    snprintf(ip, sizeof(ip), "127.%u.%u.%u", 1 + n / 65536, (n / 256) % 256, n % 256);
+    d.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = wihome_sockaddr(ip, port);
+    if (d.fd < 0 || bind(d.fd, (sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+      fprintf(stderr, "Could not bind %s:%u: %s\n", ip, port, strerror(errno));
+      return 1;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = n;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, d.fd, &event);
+    d.hub = hub;
+    // Spread the start of the devices evenly over one second:
+    d.findhub_sent = 0;
+    d.next_send = t_start + (1000000000ULL * n) / N_devices;
+  }
+  printf("%u devices, %.2f messages/s each, hub %s:%u\n", N_devices, rate, hub_ip, port);
+  fflush(stdout);
+
+  char message[WIHOME_MAX_PACKET];
+  char packet[WIHOME_MAX_PACKET];
+  uint64_t sent = 0, received = 0, errors = 0, hubid = 0, findclient = 0;
+  WiHomeLatency findhub_latency;
+  uint64_t t_report = t_start;
+  while (wihome_now_ns() - t_start < duration * 1e9)
+  {
+    epoll_event events[64];
+    int N_events = epoll_wait(epoll_fd, events, 64, 1);
+    for (int n=0; n<N_events; n++)
+    {
+      LoadgenDevice& d = devices[events[n].data.u32];
+      sockaddr_in from;
+      socklen_t from_length = sizeof(from);
+      ssize_t length;
+      while ((length = recvfrom(d.fd, packet, sizeof(packet), 0, (sockaddr*) &from, &from_length)) > 0)
+      {
+        received++;
+        std::string cmd, client;
+        if (!wihome_json_string(packet, length, "cmd", cmd))
+          continue;
+        if (cmd == "hubid")
+        {
+          hubid++;
+          if (d.findhub_sent)
+            findhub_latency.add(wihome_now_ns() - d.findhub_sent);
+          d.hub = from;
+          d.hub.sin_port = htons(port);
+          d.hub_found = true;
+        }
+        else if (cmd == "findclient" && wihome_json_string(packet, length, "client", client) && client == d.client)
+        {
+          findclient++;
+          // serve_packet() replies with the received document and cmd replaced:
+          int n_message = snprintf(message, sizeof(message), "{\"cmd\":\"clientid\",\"client\":\"%s\"}", d.client);
+          sockaddr_in to = from;
+          to.sin_port = htons(port);
+          if (sendto(d.fd, message, n_message, 0, (sockaddr*) &to, sizeof(to)) == n_message)
+            sent++;
+          else
+            errors++;
+          d.hub = to;
+          d.hub_found = true;
+        }
+      }
+    }
+    uint64_t now = wihome_now_ns();
+    for (auto& d : devices)
+    {
+      // First findhub at the staggered start time, then every 60 s like findhub():
+      if (d.findhub_sent ? (now - d.findhub_sent >= LOADGEN_FINDHUB_INTERVAL) : (now >= d.next_send))
+      {
+        // findhub() goes to the broadcast address, here straight to the hub:
+        int n_message = snprintf(message, sizeof(message), "{\"cmd\":\"findhub\",\"client\":\"%s\",\"t1\":%llu}",
+                                 d.client, (unsigned long long) (now / 1000));
+        if (sendto(d.fd, message, n_message, 0, (sockaddr*) &hub, sizeof(hub)) == n_message)
+          sent++;
+        else
+          errors++;
+        d.findhub_sent = now;
+        continue;
+      }
+      if (interval && d.hub_found && now >= d.next_send)
+      {
+        // sendJSON("seq", n, "value", v) followed by send() adding the client:
+        int n_message;
+        if (stamp)
+          n_message = snprintf(message, sizeof(message), "{\"seq\":%lu,\"value\":%lu,\"client\":\"%s\",\"_seq\":%lu,\"_ts\":%llu}",
+                               d.seq, d.seq % 100, d.client, d.seq + 1, (unsigned long long) wihome_realtime_us());
+        else
+          n_message = snprintf(message, sizeof(message), "{\"seq\":%lu,\"value\":%lu,\"client\":\"%s\"}",
+                               d.seq, d.seq % 100, d.client);
+        if (sendto(d.fd, message, n_message, 0, (sockaddr*) &d.hub, sizeof(d.hub)) == n_message)
+          sent++;
+        else
+          errors++;
+        d.seq++;
+        d.next_send += interval;
+        if (d.next_send < now)
+          d.next_send = now; // do not burst after falling behind
+      }
+    }
+    if (now - t_report >= 1000000000ULL)
+    {
+      double seconds = (now - t_report) / 1e9;
+      printf("sent/s=%.0f received/s=%.0f errors=%llu hubid=%llu findclient=%llu findhub_rtt_us p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+             sent / seconds, received / seconds, (unsigned long long) errors, (unsigned long long) hubid,
+             (unsigned long long) findclient, findhub_latency.percentile_us(50), findhub_latency.percentile_us(90),
+             findhub_latency.percentile_us(99), findhub_latency.max_us());
+      fflush(stdout);
+      sent = received = errors = hubid = findclient = 0;
+      findhub_latency.clear();
+      t_report = now;
+    }
+  }
+  for (auto& d : devices)
+    close(d.fd);
+  return 0;
+}
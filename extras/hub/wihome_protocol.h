@@ -0,0 +1,164 @@
+// WiHome protocol helpers for the host side hub and load generator
+//
+// Messages are flat JSON objects as produced by WiHomeComm (ArduinoJson):
+//   device -> broadcast: {"cmd":"findhub","client":"<name>","t1":<device us>}
+//   hub -> device:       {"cmd":"hubid","t1":<t1>,"t2":<hub receive us>,"t3":<hub send us>}
+//   hub -> broadcast:    {"cmd":"findclient","client":"<name>"}
+//   device -> hub:       {"cmd":"clientid","client":"<name>"}
+//   device -> hub:       {...application fields...,"client":"<name>"}   (send())
+//                        with stamp_messages also "_seq":<n> and, once the clock is
+//                        synchronized, "_ts":<hub us>
+// Hub times are Unix time in microseconds; devices synchronize to them (WiHomeSync).
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifndef WIHOME_PROTOCOL_H
+#define WIHOME_PROTOCOL_H
+
+#define WIHOME_UDP_PORT 24557
+#define WIHOME_MAX_PACKET 1024
+
+inline uint64_t wihome_now_ns()
+{
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+inline uint64_t wihome_realtime_us()
+{
+  timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return (uint64_t) t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+inline sockaddr_in wihome_sockaddr(const char* ip, unsigned int port)
+{
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, ip, &addr.sin_addr);
+  return addr;
+}
+
+// Skips one JSON value starting at p, returns the position after it:
+inline const char* wihome_json_skip(const char* p, const char* end)
+{
+  if (p >= end)
+    return end;
+  if (*p == '"')
+  {
+    for (p++; p < end && *p != '"'; p++)
+      if (*p == '\\')
+        p++;
+    return (p < end) ? p + 1 : end;
+  }
+  if (*p == '{' || *p == '[')
+  {
+    int depth = 0;
+    for (; p < end; p++)
+    {
+      if (*p == '"')
+      {
+        p = wihome_json_skip(p, end) - 1;
+        continue;
+      }
+      if (*p == '{' || *p == '[')
+        depth++;
+      else if (*p == '}' || *p == ']')
+        if (--depth == 0)
+          return p + 1;
+    }
+    return end;
+  }
+  while (p < end && *p != ',' && *p != '}' && *p != ']')
+    p++;
+  return p;
+}
+
+// Finds the top level value of key in a flat JSON object, returns its start or NULL:
+inline const char* wihome_json_value(const char* json, size_t length, const char* key)
+{
+  const char* p = json;
+  const char* end = json + length;
+  size_t key_length = strlen(key);
+  while (p < end && *p != '{')
+    p++;
+  p++;
+  while (p < end)
+  {
+    while (p < end && (*p == ' ' || *p == ',' || *p == '\n' || *p == '\r' || *p == '\t'))
+      p++;
+    if (p >= end || *p != '"')
+      return NULL;
+    const char* k = p + 1;
+    p = wihome_json_skip(p, end);
+    bool match = ((size_t) (p - k - 1) == key_length) && (strncmp(k, key, key_length) == 0);
+    while (p < end && (*p == ' ' || *p == ':'))
+      p++;
+    if (match)
+      return (p < end) ? p : NULL;
+    p = wihome_json_skip(p, end);
+  }
+  return NULL;
+}
+
+// Finds the top level string value of key in a flat JSON object; escapes are not decoded.
+inline bool wihome_json_string(const char* json, size_t length, const char* key, std::string& value)
+{
+  const char* end = json + length;
+  const char* p = wihome_json_value(json, length, key);
+  if (!p || *p != '"')
+    return false;
+  const char* v = p + 1;
+  p = wihome_json_skip(p, end);
+  value.assign(v, p - v - 1);
+  return true;
+}
+
+// Finds the top level unsigned integer value of key in a flat JSON object.
+inline bool wihome_json_uint64(const char* json, size_t length, const char* key, uint64_t& value)
+{
+  const char* end = json + length;
+  const char* p = wihome_json_value(json, length, key);
+  if (!p || *p < '0' || *p > '9')
+    return false;
+  value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    value = value * 10 + (*p - '0');
+  return true;
+}
+
+// Latency samples of one report interval
+class WiHomeLatency
+{
+  private:
+    std::vector<uint64_t> samples;
+  public:
+    void add(uint64_t ns) { samples.push_back(ns); }
+    size_t size() { return samples.size(); }
+    void clear() { samples.clear(); }
+    double percentile_us(double p)
+    {
+      if (samples.empty())
+        return 0;
+      size_t n = std::min(samples.size() - 1, (size_t) (p / 100.0 * samples.size()));
+      std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+      return samples[n] / 1000.0;
+    }
+    double max_us()
+    {
+      if (samples.empty())
+        return 0;
+      return *std::max_element(samples.begin(), samples.end()) / 1000.0;
+    }
+};
+
+#endif // WIHOME_PROTOCOL_H
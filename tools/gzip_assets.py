@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Compresses the static web assets in data/ into PROGMEM arrays in WiHomeAssets.h
+#
+# Usage: python3 tools/gzip_assets.py [data_dir] [output_header]
+# Run after editing any file in data/ and commit the regenerated header.
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.svg': 'image/svg+xml',
+    '.ico': 'image/x-icon',
+}
+
+# All assets are revalidated on every view (answered with 304 while the ETag
+# matches): the URIs carry no version, so a firmware update has to reach the
+# browser right away with a matching /main.js and /values.json:
+CACHE_CONTROL = 'no-cache'
+
+
+def c_identifier(name):
+    return 'asset_' + re.sub(r'[^0-9A-Za-z]', '_', name) + '_gz'
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    data_dir = sys.argv[1] if len(sys.argv) > 1 else os.path.join(root, 'data')
+    output = sys.argv[2] if len(sys.argv) > 2 else os.path.join(root, 'WiHomeAssets.h')
+
+    arrays = []
+    entries = []
+    for name in sorted(os.listdir(data_dir)):
+        path = os.path.join(data_dir, name)
+        ext = os.path.splitext(name)[1]
+        if not os.path.isfile(path) or ext not in CONTENT_TYPES:
+            continue
+        with open(path, 'rb') as f:
+            raw = f.read()
+        # mtime=0 keeps the output (and therefore the ETag) reproducible:
+        data = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = '"' + hashlib.sha1(data).hexdigest()[:16] + '"'
+        ident = c_identifier(name)
+        lines = []
+        for n in range(0, len(data), 16):
+            lines.append('  ' + ','.join('0x%02x' % b for b in data[n:n+16]) + ',')
+        arrays.append('// %s: %d bytes, %d bytes gzipped\nconst uint8_t %s[] PROGMEM = {\n%s\n};\n'
+                      % (name, len(raw), len(data), ident, '\n'.join(lines)))
+        entries.append('  {"/%s", "%s", "%s", "%s", %s, sizeof(%s)},'
+                       % (name, CONTENT_TYPES[ext], etag.replace('"', '\\"'),
+                          CACHE_CONTROL, ident, ident))
+
+    with open(output, 'w') as f:
+        f.write('// WiHome static web assets (gzip compressed)\n')
+        f.write('// Generated by tools/gzip_assets.py from data/ - do not edit.\n')
+        f.write('#include <pgmspace.h>\n#include "Arduino.h"\n\n')
+        f.write('#ifndef WIHOMEASSETS_H\n#define WIHOMEASSETS_H\n\n')
+        f.write('struct WiHomeAsset\n{\n  const char* uri;\n  const char* content_type;\n'
+                '  const char* etag;\n  const char* cache_control;\n  const uint8_t* data;\n'
+                '  size_t length;\n};\n\n')
+        f.write('\n'.join(arrays))
+        f.write('\nconst WiHomeAsset wihome_assets[] = {\n%s\n};\n' % '\n'.join(entries))
+        f.write('const unsigned int N_wihome_assets = sizeof(wihome_assets)/sizeof(wihome_assets[0]);\n')
+        f.write('\n#endif // WIHOMEASSETS_H\n')
+    print('Wrote %d assets to %s' % (len(entries), output))
+
+
+if __name__ == '__main__':
+    main()